@@ -0,0 +1,103 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <string>
+
+#include "sugar.hpp"
+
+void Bench::report(const std::string& name, std::vector<dbl> samples_ns, u64 ops) {
+	if (samples_ns.empty() || !this->enabled(name)) return;
+
+	std::sort(samples_ns.begin(), samples_ns.end());
+	auto per_op = [&](usz idx) {
+		return samples_ns[std::min(idx, samples_ns.size() - 1u)] / static_cast<dbl>(ops);
+	};
+	auto result = BenchResult {
+		.name = name,
+		.samples = samples_ns.size(),
+		.ops = ops,
+		.median_ns = per_op(samples_ns.size() / 2u),
+		.min_ns = per_op(0u),
+		.p90_ns = per_op(samples_ns.size() * 9u / 10u),
+	};
+
+	std::fprintf(stderr, "%-32s %12.1f ns/op  (min %.1f, p90 %.1f)\n",
+		name.c_str(), result.median_ns, result.min_ns, result.p90_ns);
+	this->res.push_back(std::move(result));
+}
+
+void write_results(std::ostream& out, const std::vector<BenchResult>& results) {
+	for (auto& r : results) {
+		out << std::setprecision(6) << std::fixed
+			<< "{\"name\":\"" << r.name << "\""
+			<< ",\"samples\":" << r.samples
+			<< ",\"ops\":" << r.ops
+			<< ",\"median_ns\":" << r.median_ns
+			<< ",\"min_ns\":" << r.min_ns
+			<< ",\"p90_ns\":" << r.p90_ns
+			<< "}\n";
+	}
+}
+
+// only understands the flat objects written by write_results
+static auto field(const std::string& line, const std::string& key) -> std::string {
+	auto quoted = "\"" + key + "\":";
+	auto pos = line.find(quoted);
+	if (pos == std::string::npos) return {};
+	pos += quoted.size();
+	if (line[pos] == '"') {
+		auto end = line.find('"', pos + 1u);
+		return line.substr(pos + 1u, end - pos - 1u);
+	}
+	auto end = line.find_first_of(",}", pos);
+	return line.substr(pos, end - pos);
+}
+
+auto read_results(std::istream& in) -> std::vector<BenchResult> {
+	auto ret = std::vector<BenchResult>{};
+	auto line = std::string{};
+	while (std::getline(in, line)) {
+		auto name = field(line, "name");
+		if (name.empty()) continue;
+		ret.push_back(BenchResult {
+			.name = name,
+			.samples = std::stoull(field(line, "samples")),
+			.ops = std::stoull(field(line, "ops")),
+			.median_ns = std::stod(field(line, "median_ns")),
+			.min_ns = std::stod(field(line, "min_ns")),
+			.p90_ns = std::stod(field(line, "p90_ns")),
+		});
+	}
+	return ret;
+}
+
+auto compare_results(
+	std::ostream& out,
+	const std::vector<BenchResult>& results,
+	const std::vector<BenchResult>& baseline,
+	dbl threshold
+) -> bool {
+	auto ok = true;
+	for (auto& r : results) {
+		auto base = std::find_if(baseline.begin(), baseline.end(),
+			[&](const BenchResult& b) { return b.name == r.name; }
+		);
+		if (base == baseline.end()) {
+			out << std::left << std::setw(32) << r.name << " (not in baseline)\n";
+			continue;
+		}
+
+		auto change = r.median_ns / base->median_ns - 1.0;
+		auto regressed = change > threshold;
+		ok &= !regressed;
+		out << std::left << std::setw(32) << r.name
+			<< std::right << std::fixed << std::setprecision(1)
+			<< std::setw(12) << base->median_ns << " -> "
+			<< std::setw(12) << r.median_ns << " ns/op "
+			<< std::showpos << std::setw(7) << change * 100.0 << "%" << std::noshowpos
+			<< (regressed ? "  REGRESSION" : "") << "\n";
+	}
+	return ok;
+}
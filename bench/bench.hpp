@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "sugar.hpp"
+
+struct BenchResult {
+	std::string name;
+	u64 samples;
+	u64 ops; // operations per sample
+	dbl median_ns; // all times are per operation
+	dbl min_ns;
+	dbl p90_ns;
+};
+
+// keeps the optimizer from discarding a value that is otherwise unused
+template<typename T>
+inline void keep(const T& value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class Bench {
+
+public:
+	explicit Bench(std::string filter) : filter{std::move(filter)} {}
+
+	auto enabled(const std::string& name) const -> bool {
+		return this->filter.empty() || name.find(this->filter) != std::string::npos;
+	}
+
+	// Calls body (which performs `ops` operations) in batches long enough to be
+	// timed reliably and records one sample per batch.
+	template<typename F>
+	void run(const std::string& name, u64 ops, F&& body) {
+		if (!this->enabled(name)) return;
+		using clock = std::chrono::steady_clock;
+
+		u64 calls = 1u;
+		while (true) {
+			auto start = clock::now();
+			for (u64 i = 0u; i < calls; i++) body();
+			if (clock::now() - start >= MIN_BATCH_TIME) break;
+			calls *= 2u;
+		}
+
+		auto samples = std::vector<dbl>{};
+		samples.reserve(SAMPLES);
+		for (usz s = 0u; s < SAMPLES; s++) {
+			auto start = clock::now();
+			for (u64 i = 0u; i < calls; i++) body();
+			std::chrono::duration<dbl, std::nano> elapsed = clock::now() - start;
+			samples.push_back(elapsed.count());
+		}
+		this->report(name, std::move(samples), calls * ops);
+	}
+
+	// records samples measured by the caller, each covering `ops` operations
+	void report(const std::string& name, std::vector<dbl> samples_ns, u64 ops = 1u);
+
+	auto results() const -> const std::vector<BenchResult>& {
+		return this->res;
+	}
+
+private:
+	static constexpr usz SAMPLES = 30u;
+	static constexpr auto MIN_BATCH_TIME = std::chrono::milliseconds(2);
+
+	std::string filter;
+	std::vector<BenchResult> res{};
+
+};
+
+// one JSON object per line, so results can be diffed and appended
+void write_results(std::ostream& out, const std::vector<BenchResult>& results);
+auto read_results(std::istream& in) -> std::vector<BenchResult>;
+
+// prints the change of every result against the baseline,
+// returns false if any median got slower by more than `threshold` (0.1 = 10%)
+auto compare_results(
+	std::ostream& out,
+	const std::vector<BenchResult>& results,
+	const std::vector<BenchResult>& baseline,
+	dbl threshold
+) -> bool;
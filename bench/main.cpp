@@ -0,0 +1,248 @@
+// Micro- and frame benchmarks.
+//
+// vk_bench [--filter <substr>] [--out <results.jsonl>] [--baseline <results.jsonl>]
+//          [--threshold <fraction>] [--frames <n>] [--no-gpu]
+//
+// Frame benchmarks run the renderer headless. To pin them to lavapipe, point the
+// loader at its ICD, e.g. VK_DRIVER_FILES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json
+// Exits with 1 if any result regressed past the threshold against the baseline, or,
+// when built with VK_COUNT_ALLOCS, if a frame benchmark allocated after warmup.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc_count.hpp"
+#include "arena.hpp"
+#include "bench.hpp"
+#include "renderer.hpp"
+#include "sugar.hpp"
+
+constexpr glm::ivec2 FRAME_SZ = {1280, 720};
+constexpr usz WARMUP_FRAMES = 30u;
+
+static auto random_commands(usz count) -> std::vector<DrawCommand> {
+	auto rng = std::mt19937_64{0x5eedu};
+	auto ret = std::vector<DrawCommand>(count);
+	for (auto& cmd : ret) {
+		cmd = DrawCommand {
+			.sort_key = rng(),
+			.vertex_count = 3u,
+			.instance_count = 1u,
+			.first_vertex = 0u,
+			.first_instance = 0u,
+		};
+	}
+	return ret;
+}
+
+static void bench_arena(Bench& bench) {
+	constexpr u64 ALLOCS = 1024u;
+	auto arena = Arena(1024 * 1024);
+	bench.run("arena/alloc", ALLOCS, [&] {
+		for (u64 i = 0u; i < ALLOCS; i++) {
+			keep(arena.alloc<FramePacket>());
+		}
+		arena.reset();
+	});
+
+	constexpr u64 ARRAYS = 64u;
+	bench.run("arena/alloc_array_64", ARRAYS, [&] {
+		for (u64 i = 0u; i < ARRAYS; i++) {
+			keep(arena.alloc_array<DrawCommand>(64u).data());
+		}
+		arena.reset();
+	});
+}
+
+// same handoff as main.cpp, with the render thread replaced by an echo
+static void bench_handoff(Bench& bench) {
+	if (!bench.enabled("spsc/frame_handoff")) return;
+
+	auto render_queue = FrameQueue{};
+	auto free_queue = FrameQueue{};
+	auto ctxs = std::vector<std::unique_ptr<FrameContext>>{};
+	for (usz i = 0u; i < 3u; i++) {
+		ctxs.push_back(std::make_unique<FrameContext>());
+		free_queue.push(ctxs.back().get());
+	}
+
+	auto running = std::atomic<bool>{true};
+	auto consumer = std::thread([&] {
+		while (running) {
+			FrameContext* ctx = nullptr;
+			if (render_queue.pop(ctx)) {
+				keep(ctx->pkts.front()->dt);
+				while (!free_queue.push(ctx)) std::this_thread::yield();
+			}
+		}
+	});
+
+	bench.run("spsc/frame_handoff", 1u, [&] {
+		FrameContext* ctx = nullptr;
+		while (!free_queue.pop(ctx)) {}
+		ctx->arena.reset();
+		ctx->pkts = ctx->arena.alloc_array<FramePacket*>(1u);
+		ctx->pkts[0] = ctx->arena.alloc<FramePacket>();
+		ctx->pkts[0]->dt = 0.016f;
+		while (!render_queue.push(ctx)) {}
+	});
+
+	running.store(false);
+	consumer.join();
+}
+
+static void bench_sort(Bench& bench) {
+	for (usz count : {100u, 10'000u}) {
+		auto src = random_commands(count);
+		auto scratch = src;
+		bench.run("draw/sort_" + std::to_string(count), 1u, [&] {
+			std::copy(src.begin(), src.end(), scratch.begin());
+			sort_draw_commands(scratch);
+			keep(scratch.front().sort_key);
+		});
+	}
+}
+
+// puts the commands into `groups` draw groups, 0 makes them all per-frame draws
+static void set_groups(std::span<DrawCommand> commands, u64 groups) {
+	constexpr u64 ORDER_MASK = (u64{1u} << DRAW_GROUP_SHIFT) - 1u;
+	for (usz i = 0u; i < commands.size(); i++) {
+		auto group = groups == 0u ? 0u : 1u + i % groups;
+		commands[i].sort_key = (commands[i].sort_key & ORDER_MASK) | (group << DRAW_GROUP_SHIFT);
+	}
+}
+
+// reports the wall time of Renderer::draw and the part of it spent recording,
+// returns the heap allocations draw made after warmup (counted with VK_COUNT_ALLOCS)
+static auto bench_frames(Bench& bench, Renderer& renderer, usz frames) -> u64 {
+	auto heap_allocs = u64{0u};
+	struct Case {
+		std::string name;
+		usz count;
+		u64 groups;
+	};
+	auto cases = std::array{
+		Case{"frame/draws_1", 1u, 0u},
+		Case{"frame/draws_10000", 10'000u, 0u},
+		// the same draws as cached static groups
+		Case{"frame/static_draws_10000", 10'000u, 100u},
+	};
+
+	for (auto& [name, count, groups] : cases) {
+		if (!bench.enabled(name)) continue;
+
+		auto commands = random_commands(count);
+		set_groups(commands, groups);
+		auto ctx = FrameContext();
+		auto wall = std::vector<dbl>{};
+		auto record = std::vector<dbl>{};
+		wall.reserve(frames);
+		record.reserve(frames);
+
+		for (usz i = 0u; i < WARMUP_FRAMES + frames; i++) {
+			ctx.arena.reset();
+			auto pkt = ctx.arena.alloc<FramePacket>();
+			pkt->t = static_cast<flt>(i) / 60.0f;
+			pkt->dt = 1.0f / 60.0f;
+			pkt->drawable_sz = FRAME_SZ;
+			pkt->commands = ctx.arena.alloc_array<DrawCommand>(count);
+			std::copy(commands.begin(), commands.end(), pkt->commands.begin());
+
+			auto allocs = thread_heap_allocs();
+			auto start = std::chrono::steady_clock::now();
+			renderer.draw(pkt);
+			std::chrono::duration<dbl, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+			if (i >= WARMUP_FRAMES) {
+				heap_allocs += thread_heap_allocs() - allocs;
+				wall.push_back(elapsed.count());
+				record.push_back(static_cast<dbl>(renderer.last_record_ns()));
+			}
+		}
+		renderer.wait_idle();
+
+		bench.report(name + "/wall", std::move(wall));
+		bench.report(name + "/record", std::move(record));
+	}
+	return heap_allocs;
+}
+
+int main(int argc, char** argv) {
+	auto filter = std::string{};
+	auto out_path = std::string{};
+	auto baseline_path = std::string{};
+	auto threshold = 0.1;
+	usz frames = 500u;
+	auto gpu = true;
+
+	for (int i = 1; i < argc; i++) {
+		auto arg = std::string(argv[i]);
+		auto next = [&]() -> std::string {
+			if (i + 1 >= argc) {
+				std::cerr << arg << " needs a value" << std::endl;
+				std::exit(2);
+			}
+			return argv[++i];
+		};
+		if (arg == "--filter") filter = next();
+		else if (arg == "--out") out_path = next();
+		else if (arg == "--baseline") baseline_path = next();
+		else if (arg == "--threshold") threshold = std::stod(next());
+		else if (arg == "--frames") frames = std::stoull(next());
+		else if (arg == "--no-gpu") gpu = false;
+		else {
+			std::cerr << "unknown argument " << arg << std::endl;
+			return 2;
+		}
+	}
+
+	auto bench = Bench(filter);
+	bench_arena(bench);
+	bench_handoff(bench);
+	bench_sort(bench);
+
+	auto heap_allocs = u64{0u};
+	if (gpu) {
+		try {
+			auto renderer = Renderer(nullptr);
+			heap_allocs = bench_frames(bench, renderer, frames);
+		} catch (std::exception& e) {
+			std::cerr << "skipping frame benchmarks: " << e.what() << std::endl;
+		}
+	}
+
+	if (out_path.empty()) {
+		write_results(std::cout, bench.results());
+	} else {
+		auto out = std::ofstream(out_path);
+		write_results(out, bench.results());
+	}
+
+	// steady-state frames must not touch the general heap
+	if (heap_allocs > 0u) {
+		std::cerr << heap_allocs << " heap allocations in Renderer::draw after warmup" << std::endl;
+		return 1;
+	}
+
+	if (!baseline_path.empty()) {
+		auto in = std::ifstream(baseline_path);
+		if (!in.is_open()) {
+			std::cerr << "failed to open baseline " << baseline_path << std::endl;
+			return 2;
+		}
+		if (!compare_results(std::cerr, bench.results(), read_results(in), threshold)) {
+			return 1;
+		}
+	}
+}
@@ -0,0 +1,165 @@
+# Generates a header embedding a compiled SPIR-V module and the descriptor set,
+# push constant and entry point layout taken from its Slang reflection JSON.
+#
+# usage: cmake -DNAME=<ident> -DSPIRV=<file.spv> -DREFLECTION=<file.json> -DOUTPUT=<file.hpp> -P embed_shader.cmake
+
+foreach(VAR NAME SPIRV REFLECTION OUTPUT)
+	if(NOT DEFINED ${VAR})
+		message(FATAL_ERROR "embed_shader.cmake: ${VAR} is not set")
+	endif()
+endforeach()
+
+function(stage_flag STAGE OUT)
+	if(STAGE STREQUAL "vertex")
+		set(${OUT} "vk::ShaderStageFlagBits::eVertex" PARENT_SCOPE)
+	elseif(STAGE STREQUAL "fragment")
+		set(${OUT} "vk::ShaderStageFlagBits::eFragment" PARENT_SCOPE)
+	elseif(STAGE STREQUAL "compute")
+		set(${OUT} "vk::ShaderStageFlagBits::eCompute" PARENT_SCOPE)
+	elseif(STAGE STREQUAL "amplification")
+		set(${OUT} "vk::ShaderStageFlagBits::eTaskEXT" PARENT_SCOPE)
+	elseif(STAGE STREQUAL "mesh")
+		set(${OUT} "vk::ShaderStageFlagBits::eMeshEXT" PARENT_SCOPE)
+	else()
+		message(FATAL_ERROR "${NAME}: unsupported shader stage '${STAGE}'")
+	endif()
+endfunction()
+
+# maps a reflected parameter type to a descriptor type, anything unknown is a build error
+function(descriptor_type PARAM_NAME TYPE_JSON OUT)
+	string(JSON KIND GET "${TYPE_JSON}" kind)
+	if(KIND STREQUAL "constantBuffer")
+		set(${OUT} "vk::DescriptorType::eUniformBuffer" PARENT_SCOPE)
+	elseif(KIND STREQUAL "samplerState")
+		set(${OUT} "vk::DescriptorType::eSampler" PARENT_SCOPE)
+	elseif(KIND STREQUAL "resource")
+		string(JSON SHAPE GET "${TYPE_JSON}" baseShape)
+		string(JSON ACCESS ERROR_VARIABLE NO_ACCESS GET "${TYPE_JSON}" access)
+		string(JSON COMBINED ERROR_VARIABLE NO_COMBINED GET "${TYPE_JSON}" combined)
+		if(SHAPE STREQUAL "structuredBuffer" OR SHAPE STREQUAL "byteAddressBuffer")
+			set(${OUT} "vk::DescriptorType::eStorageBuffer" PARENT_SCOPE)
+		elseif(SHAPE STREQUAL "textureBuffer")
+			if(ACCESS STREQUAL "readWrite")
+				set(${OUT} "vk::DescriptorType::eStorageTexelBuffer" PARENT_SCOPE)
+			else()
+				set(${OUT} "vk::DescriptorType::eUniformTexelBuffer" PARENT_SCOPE)
+			endif()
+		elseif(SHAPE MATCHES "^texture")
+			if(COMBINED)
+				set(${OUT} "vk::DescriptorType::eCombinedImageSampler" PARENT_SCOPE)
+			elseif(ACCESS STREQUAL "readWrite")
+				set(${OUT} "vk::DescriptorType::eStorageImage" PARENT_SCOPE)
+			else()
+				set(${OUT} "vk::DescriptorType::eSampledImage" PARENT_SCOPE)
+			endif()
+		else()
+			message(FATAL_ERROR "${NAME}: parameter '${PARAM_NAME}' has unsupported resource shape '${SHAPE}'")
+		endif()
+	else()
+		message(FATAL_ERROR "${NAME}: parameter '${PARAM_NAME}' has unsupported type kind '${KIND}'")
+	endif()
+endfunction()
+
+# spir-v words, stored little endian
+file(READ "${SPIRV}" SPIRV_HEX HEX)
+string(LENGTH "${SPIRV_HEX}" SPIRV_HEX_LEN)
+math(EXPR SPIRV_WORDS "${SPIRV_HEX_LEN} / 8")
+math(EXPR SPIRV_REM "${SPIRV_HEX_LEN} % 8")
+if(SPIRV_WORDS EQUAL 0 OR NOT SPIRV_REM EQUAL 0)
+	message(FATAL_ERROR "${NAME}: ${SPIRV} is not a SPIR-V module")
+endif()
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u, " SPIRV_BODY "${SPIRV_HEX}")
+# cmake regexes have no {n} repetition, so spell out eight words per line
+set(WORD "0x........u, ")
+string(REGEX REPLACE "(${WORD}${WORD}${WORD}${WORD}${WORD}${WORD}${WORD}${WORD})" "\\1\n\t\t" SPIRV_BODY "${SPIRV_BODY}")
+string(REGEX REPLACE " \n" "\n" SPIRV_BODY "${SPIRV_BODY}")
+string(STRIP "${SPIRV_BODY}" SPIRV_BODY)
+
+file(READ "${REFLECTION}" JSON)
+
+# entry points
+set(STAGES "")
+set(ENTRY_POINTS "")
+string(JSON EP_COUNT LENGTH "${JSON}" entryPoints)
+if(EP_COUNT GREATER 0)
+	math(EXPR EP_LAST "${EP_COUNT} - 1")
+	foreach(I RANGE ${EP_LAST})
+		string(JSON EP_NAME GET "${JSON}" entryPoints ${I} name)
+		string(JSON EP_STAGE GET "${JSON}" entryPoints ${I} stage)
+		stage_flag(${EP_STAGE} FLAG)
+		list(APPEND STAGES "${FLAG}")
+		string(APPEND ENTRY_POINTS "\n\t\t{ .name = \"${EP_NAME}\", .stage = ${FLAG} },")
+	endforeach()
+endif()
+list(REMOVE_DUPLICATES STAGES)
+list(JOIN STAGES " | " STAGES)
+if(STAGES STREQUAL "")
+	set(STAGES "vk::ShaderStageFlags{}")
+else()
+	set(STAGES "vk::ShaderStageFlags(${STAGES})")
+endif()
+
+# global parameters, every binding is visible to every stage of the module
+set(BINDINGS "")
+set(BINDING_COUNT 0)
+set(PUSH_CONSTANTS "")
+set(PUSH_CONSTANT_COUNT 0)
+string(JSON PARAM_COUNT LENGTH "${JSON}" parameters)
+if(PARAM_COUNT GREATER 0)
+	math(EXPR PARAM_LAST "${PARAM_COUNT} - 1")
+	foreach(I RANGE ${PARAM_LAST})
+		string(JSON PARAM GET "${JSON}" parameters ${I})
+		string(JSON PARAM_NAME GET "${PARAM}" name)
+		string(JSON BINDING_KIND GET "${PARAM}" binding kind)
+		string(JSON TYPE GET "${PARAM}" type)
+
+		if(BINDING_KIND STREQUAL "descriptorTableSlot")
+			string(JSON INDEX GET "${PARAM}" binding index)
+			string(JSON SPACE ERROR_VARIABLE NO_SPACE GET "${PARAM}" binding space)
+			if(NO_SPACE)
+				set(SPACE 0)
+			endif()
+			set(COUNT 1)
+			string(JSON TYPE_KIND GET "${TYPE}" kind)
+			if(TYPE_KIND STREQUAL "array")
+				string(JSON COUNT GET "${TYPE}" elementCount)
+				string(JSON TYPE GET "${TYPE}" elementType)
+			endif()
+			descriptor_type(${PARAM_NAME} "${TYPE}" DESC_TYPE)
+			string(APPEND BINDINGS "\n\t\t{ .name = \"${PARAM_NAME}\", .set = ${SPACE}u, .binding = ${INDEX}u, .type = ${DESC_TYPE}, .count = ${COUNT}u },")
+			math(EXPR BINDING_COUNT "${BINDING_COUNT} + 1")
+		elseif(BINDING_KIND STREQUAL "pushConstantBuffer")
+			string(JSON SIZE GET "${TYPE}" elementVarLayout binding size)
+			string(APPEND PUSH_CONSTANTS "\n\t\t{ .name = \"${PARAM_NAME}\", .offset = 0u, .size = ${SIZE}u },")
+			math(EXPR PUSH_CONSTANT_COUNT "${PUSH_CONSTANT_COUNT} + 1")
+		else()
+			message(FATAL_ERROR "${NAME}: parameter '${PARAM_NAME}' has unsupported binding kind '${BINDING_KIND}'")
+		endif()
+	endforeach()
+endif()
+
+set(CONTENT "// generated by cmake/embed_shader.cmake from ${NAME}.slang, do not edit
+#pragma once
+
+#include \"shader.hpp\"
+
+namespace shaders {
+
+inline constexpr auto ${NAME} = ShaderModule<${SPIRV_WORDS}, ${EP_COUNT}, ${BINDING_COUNT}, ${PUSH_CONSTANT_COUNT}>{
+	.spirv = {
+		${SPIRV_BODY}
+	},
+	.stages = ${STAGES},
+	.entry_points = {{${ENTRY_POINTS}
+	}},
+	.bindings = {{${BINDINGS}
+	}},
+	.push_constants = {{${PUSH_CONSTANTS}
+	}},
+};
+
+}
+")
+
+# only touch the header when it changes so dependents are not rebuilt needlessly
+file(CONFIGURE OUTPUT "${OUTPUT}" CONTENT "${CONTENT}" @ONLY)
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "sugar.hpp"
+
+// Built with VK_COUNT_ALLOCS, every global operator new is counted per thread
+// so steady-state frames can be checked for general-heap allocations. Anything
+// in the process that allocates through operator new on that thread counts,
+// including Vulkan layers, so check with validation layers disabled.
+// Without VK_COUNT_ALLOCS the count stays 0 and the checks pass.
+
+auto thread_heap_allocs() -> u64;
+
+// aborts if the current thread allocated since thread_heap_allocs() returned `since`
+void expect_no_heap_allocs(u64 since, const char* what);
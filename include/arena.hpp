@@ -1,14 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <charconv>
 #include <cstddef>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <memory_resource>
 #include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <cassert>
 #include <span>
 
 #include "sugar.hpp"
 
+class ArenaResource;
+template<typename T> class ArenaVector;
+template<typename K, typename V, typename Hash, typename Eq> class ArenaMap;
+
 struct Arena {
 	explicit Arena(usz size) {
 		// TODO: use a std::make_unique<std::byte[]>(size);
@@ -44,10 +57,25 @@ struct Arena {
 	}
 
 private:
+	// the adapters and containers below allocate through the raw interface
+	friend class ArenaResource;
+	template<typename T> friend class ArenaVector;
+	template<typename K, typename V, typename Hash, typename Eq> friend class ArenaMap;
+
 	std::vector<std::byte> buf;
 	std::byte* start_ptr = nullptr;
 	usz ofs = 0;
 
+	// grows the most recent allocation in place, false if ptr is not it or there is no room
+	bool try_grow(void* ptr, usz old_size, usz new_size) {
+		auto ptr_ofs = static_cast<usz>(static_cast<std::byte*>(ptr) - this->start_ptr);
+		if (ptr_ofs + old_size != this->ofs || ptr_ofs + new_size > this->buf.size()) {
+			return false;
+		}
+		this->ofs = ptr_ofs + new_size;
+		return true;
+	}
+
 	void* alloc_raw(usz size, usz alignment) {
 		void* ptr = this->start_ptr + this->ofs;
 		usz space = this->buf.size() - this->ofs;
@@ -59,3 +87,266 @@ private:
 		throw std::runtime_error("OOM in arena");
 	}
 };
+
+// For std::pmr containers. Deallocation does nothing, the memory comes back
+// with Arena::reset, so the containers must not be used past it.
+class ArenaResource final : public std::pmr::memory_resource {
+
+public:
+	explicit ArenaResource(Arena& arena) : arena{&arena} {}
+
+private:
+	Arena* arena;
+
+	void* do_allocate(usz bytes, usz alignment) override {
+		return this->arena->alloc_raw(bytes, alignment);
+	}
+
+	void do_deallocate(void*, usz, usz) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+		return this == &other;
+	}
+};
+
+// The arena containers below never run destructors and move their elements
+// with memcpy, so they only hold trivial types. Outgrown storage is left in the
+// arena until the next reset.
+
+// Growable array. Growing the arena's most recent allocation extends it in
+// place, so a vector filled without other allocations in between never copies.
+template<typename T>
+class ArenaVector {
+	static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+
+public:
+	explicit ArenaVector(Arena& arena, usz capacity = 0u) : arena{&arena} {
+		this->reserve(capacity);
+	}
+
+	// a copy would share the storage, and both would grow into it
+	ArenaVector(const ArenaVector&) = delete;
+	ArenaVector& operator=(const ArenaVector&) = delete;
+
+	void reserve(usz capacity) {
+		if (capacity <= this->cap) return;
+		if (this->ptr != nullptr && this->arena->try_grow(this->ptr, this->cap * sizeof(T), capacity * sizeof(T))) {
+			this->cap = capacity;
+			return;
+		}
+		auto next = static_cast<T*>(this->arena->alloc_raw(capacity * sizeof(T), alignof(T)));
+		if (this->len > 0u) {
+			std::memcpy(next, this->ptr, this->len * sizeof(T));
+		}
+		this->ptr = next;
+		this->cap = capacity;
+	}
+
+	void push_back(const T& value) {
+		this->emplace_back(value);
+	}
+
+	template<typename... Args>
+	T& emplace_back(Args&&... args) {
+		if (this->len == this->cap) {
+			this->reserve(std::max<usz>(this->cap * 2u, 8u));
+		}
+		return *new (this->ptr + this->len++) T(std::forward<Args>(args)...);
+	}
+
+	// new elements are value initialized
+	void resize(usz len) {
+		this->reserve(len);
+		for (usz i = this->len; i < len; i++) {
+			new (this->ptr + i) T();
+		}
+		this->len = len;
+	}
+
+	void pop_back() {
+		assert(this->len > 0u);
+		this->len--;
+	}
+
+	void clear() {
+		this->len = 0u;
+	}
+
+	auto size() const -> usz { return this->len; }
+	auto capacity() const -> usz { return this->cap; }
+	auto empty() const -> bool { return this->len == 0u; }
+	auto data() -> T* { return this->ptr; }
+	auto data() const -> const T* { return this->ptr; }
+	auto begin() -> T* { return this->ptr; }
+	auto end() -> T* { return this->ptr + this->len; }
+	auto begin() const -> const T* { return this->ptr; }
+	auto end() const -> const T* { return this->ptr + this->len; }
+	auto back() -> T& { assert(this->len > 0u); return this->ptr[this->len - 1u]; }
+
+	auto operator[](usz i) -> T& {
+		assert(i < this->len);
+		return this->ptr[i];
+	}
+
+	auto operator[](usz i) const -> const T& {
+		assert(i < this->len);
+		return this->ptr[i];
+	}
+
+	// stays valid until the vector grows or the arena is reset
+	auto span() -> std::span<T> {
+		return std::span<T>(this->ptr, this->len);
+	}
+
+private:
+	Arena* arena;
+	T* ptr = nullptr;
+	usz len = 0u;
+	usz cap = 0u;
+};
+
+// Open addressing hash map with linear probing, there is no erase.
+template<typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class ArenaMap {
+	static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_destructible_v<K>);
+	static_assert(std::is_trivially_copyable_v<V> && std::is_trivially_destructible_v<V>);
+
+public:
+	explicit ArenaMap(Arena& arena, usz capacity = 0u) : arena{&arena} {
+		if (capacity > 0u) {
+			this->rehash(std::bit_ceil(capacity + capacity / 3u + 1u));
+		}
+	}
+
+	// a copy would share the slots but count its entries apart
+	ArenaMap(const ArenaMap&) = delete;
+	ArenaMap& operator=(const ArenaMap&) = delete;
+
+	auto find(const K& key) -> V* {
+		if (this->len == 0u) return nullptr;
+		auto& slot = this->probe(key);
+		return slot.used ? &slot.value : nullptr;
+	}
+
+	auto contains(const K& key) -> bool {
+		return this->find(key) != nullptr;
+	}
+
+	// inserts value unless the key is present, either way returns the key's value
+	auto try_emplace(const K& key, const V& value = V{}) -> std::pair<V*, bool> {
+		// keep the load factor at or below 3/4
+		if (4u * (this->len + 1u) > 3u * this->cap) {
+			this->rehash(std::max<usz>(this->cap * 2u, 16u));
+		}
+		auto& slot = this->probe(key);
+		if (slot.used) return {&slot.value, false};
+		slot = Slot{ .key = key, .value = value, .used = true };
+		this->len++;
+		return {&slot.value, true};
+	}
+
+	auto operator[](const K& key) -> V& {
+		return *this->try_emplace(key).first;
+	}
+
+	// f(const K&, V&) for every entry, in no particular order
+	template<typename F>
+	void for_each(F&& f) {
+		for (usz i = 0u; i < this->cap; i++) {
+			if (this->slots[i].used) f(std::as_const(this->slots[i].key), this->slots[i].value);
+		}
+	}
+
+	void clear() {
+		for (usz i = 0u; i < this->cap; i++) {
+			this->slots[i].used = false;
+		}
+		this->len = 0u;
+	}
+
+	auto size() const -> usz { return this->len; }
+	auto empty() const -> bool { return this->len == 0u; }
+
+private:
+	struct Slot {
+		K key;
+		V value;
+		bool used;
+	};
+
+	Arena* arena;
+	Slot* slots = nullptr;
+	usz cap = 0u; // power of two
+	usz len = 0u;
+
+	// the slot holding key, or the empty slot it would go into
+	auto probe(const K& key) -> Slot& {
+		auto mask = this->cap - 1u;
+		for (auto i = static_cast<usz>(Hash{}(key)) & mask;; i = (i + 1u) & mask) {
+			auto& slot = this->slots[i];
+			if (!slot.used || Eq{}(slot.key, key)) return slot;
+		}
+	}
+
+	void rehash(usz capacity) {
+		auto old = this->slots;
+		auto old_cap = this->cap;
+		this->slots = static_cast<Slot*>(this->arena->alloc_raw(capacity * sizeof(Slot), alignof(Slot)));
+		this->cap = capacity;
+		for (usz i = 0u; i < capacity; i++) {
+			this->slots[i].used = false;
+		}
+		for (usz i = 0u; i < old_cap; i++) {
+			if (old[i].used) this->probe(old[i].key) = old[i];
+		}
+	}
+};
+
+// Builds text, e.g. per-frame labels and debug output.
+class ArenaString {
+
+public:
+	explicit ArenaString(Arena& arena, usz capacity = 0u) : chars{arena, capacity} {}
+
+	auto append(std::string_view str) -> ArenaString& {
+		auto len = this->chars.size();
+		this->chars.resize(len + str.size());
+		std::memcpy(this->chars.data() + len, str.data(), str.size());
+		return *this;
+	}
+
+	auto append(char c) -> ArenaString& {
+		this->chars.push_back(c);
+		return *this;
+	}
+
+	template<typename N>
+		requires (std::is_arithmetic_v<N> && !std::is_same_v<N, bool> && !std::is_same_v<N, char>)
+	auto append(N value) -> ArenaString& {
+		char digits[32];
+		auto res = std::to_chars(digits, digits + sizeof(digits), value);
+		return this->append(std::string_view(digits, static_cast<usz>(res.ptr - digits)));
+	}
+
+	template<typename T>
+	auto operator<<(const T& value) -> ArenaString& {
+		return this->append(value);
+	}
+
+	auto view() const -> std::string_view {
+		return std::string_view(this->chars.data(), this->chars.size());
+	}
+
+	// null terminated, valid until the next append
+	auto c_str() -> const char* {
+		this->chars.reserve(this->chars.size() + 1u);
+		this->chars.data()[this->chars.size()] = '\0';
+		return this->chars.data();
+	}
+
+	auto size() const -> usz { return this->chars.size(); }
+	void clear() { this->chars.clear(); }
+
+private:
+	ArenaVector<char> chars;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "renderer.hpp"
+#include "sugar.hpp"
+
+// Streaming FramePacket capture, replayed by vk_replay.
+//
+// file:  "VKPK" u32 version, then one record per frame
+// frame: u8 flags, flt t, flt dt, i32 drawable_sz.x, i32 drawable_sz.y,
+//        unless REPEAT_COMMANDS is set: u32 count, DrawCommand[count]
+// Everything is stored little endian in its in-memory layout.
+
+class PacketRecorder {
+
+public:
+	explicit PacketRecorder(const std::string& path);
+
+	void write(const FramePacket& pkt);
+	auto frames() const -> u64;
+
+private:
+	std::ofstream out;
+	std::vector<DrawCommand> prev_commands{};
+	u64 frame_count = 0u;
+
+};
+
+class PacketReader {
+
+public:
+	explicit PacketReader(const std::string& path);
+
+	// the packet and its commands are allocated from `arena`, nullptr once the capture ends
+	auto next(Arena& arena) -> FramePacket*;
+	// start over from the first frame
+	void rewind();
+	auto frames() const -> u64;
+
+private:
+	std::ifstream in;
+	std::streampos first_frame;
+	u64 file_size = 0u;
+	std::vector<DrawCommand> prev_commands{};
+	u64 frame_count = 0u;
+
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <functional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "sugar.hpp"
+
+// The top bits of the sort key name the draw group. Group 0 holds draws that
+// change every frame, every other group is assumed to be mostly static and is
+// recorded once into a cached secondary command buffer.
+constexpr u32 DRAW_GROUP_SHIFT = 48u;
+
+struct DrawCommand {
+	u64 sort_key; // commands are recorded in ascending key order
+	u32 vertex_count;
+	u32 instance_count;
+	u32 first_vertex;
+	u32 first_instance;
+};
+
+inline auto draw_group(const DrawCommand& cmd) -> u64 {
+	return cmd.sort_key >> DRAW_GROUP_SHIFT;
+}
+
+// deterministic for equal keys, so an unchanged group sorts into the same range every frame
+void sort_draw_commands(std::span<DrawCommand> commands);
+auto hash_draw_commands(std::span<const DrawCommand> commands) -> u64;
+
+// Secondary command buffers for draw groups, keyed by a content hash of the
+// group's commands and the extent they are drawn at, so outputs of different
+// sizes each get their own. Cached buffers are reused until their group stops
+// showing up, and all of them are dropped when the render target format
+// changes or invalidate() is called. Render thread only.
+class DrawCache {
+
+public:
+	// records the draws into a secondary command buffer that inherits the rendering state
+	using Recorder = std::function<void(vk::CommandBuffer cmd, std::span<const DrawCommand> commands)>;
+
+	DrawCache(vk::Device dev, u32 qu_fam_idx, usz frames_in_flight);
+
+	// call once per frame after the oldest frame's fence has been waited on
+	void begin_frame(vk::Format fmt, u64 frame);
+	// e.g. after the pipeline the groups were recorded with has been replaced
+	void invalidate();
+
+	// cached buffer for a static group, recorded on a miss
+	auto group(std::span<const DrawCommand> commands, vk::Extent2D extent, const Recorder& record) -> vk::CommandBuffer;
+	// buffer for draws that change every frame, recycled once the frame has retired
+	auto transient(std::span<const DrawCommand> commands, const Recorder& record) -> vk::CommandBuffer;
+
+	// groups recorded since the last begin_frame
+	auto misses() const -> u32;
+
+private:
+	struct Cached {
+		vk::CommandBuffer cmd;
+		u64 last_used;
+		// what was recorded, compared on a hit since different groups can share a hash
+		std::vector<DrawCommand> commands;
+		vk::Extent2D extent;
+	};
+
+	vk::Device dev;
+	vk::UniqueCommandPool pool;
+	usz frames_in_flight;
+	vk::Format fmt = vk::Format::eUndefined;
+	u64 frame = 0u;
+	u32 miss_count = 0u;
+	std::unordered_map<u64, Cached> cached{};
+	std::vector<std::pair<u64, vk::CommandBuffer>> retired{}; // frame it was last used in
+	std::vector<vk::CommandBuffer> free{};
+
+	auto begin(vk::CommandBufferUsageFlags flags) -> vk::CommandBuffer;
+
+};
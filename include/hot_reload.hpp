@@ -0,0 +1,60 @@
+#pragma once
+
+#ifdef VK_SHADER_HOT_RELOAD
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include "sugar.hpp"
+
+struct ReloadedPipeline {
+	std::string shader; // file stem, e.g. "triangle"
+	vk::UniquePipeline pipeline;
+};
+
+// Dev mode only: watches the slang sources with inotify, recompiles changed
+// shaders with slangc and builds their pipelines on a background thread.
+// The render thread picks finished pipelines up with poll() between frames.
+class ShaderWatcher {
+
+public:
+	// called on the watcher thread, returns a null pipeline for shaders it cannot
+	// reload and throws when the new code does not fit the pipeline
+	using Builder = std::function<vk::UniquePipeline(const std::string& shader, std::span<const u32> spirv)>;
+
+	explicit ShaderWatcher(std::filesystem::path src_dir, std::string slangc, Builder build);
+	~ShaderWatcher();
+
+	ShaderWatcher(const ShaderWatcher&) = delete;
+	ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+	// nullptr when nothing has finished building
+	auto poll() -> std::unique_ptr<ReloadedPipeline>;
+
+private:
+	void run();
+	auto compile(const std::filesystem::path& src) -> std::optional<std::vector<char>>;
+
+	std::filesystem::path src_dir;
+	std::filesystem::path out_dir;
+	std::string slangc;
+	Builder build;
+
+	int inotify_fd = -1;
+	std::atomic<bool> running{true};
+	boost::lockfree::spsc_queue<ReloadedPipeline*, boost::lockfree::capacity<16>> ready;
+	std::thread thread;
+
+};
+
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_float4.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include "shader.hpp"
+#include "sugar.hpp"
+#include "vma.hpp"
+
+// nanoseconds on steady_clock, the clock every FrameTimestamps field uses
+auto steady_ns() -> u64;
+
+// points in a frame's life, in order
+enum class LatencyStage : u8 {
+	Input,   // oldest input event the frame's packet reacts to
+	Push,    // packet handed to the render thread
+	Pop,     // render thread picked the packet up
+	Submit,  // command buffer submitted
+	Present, // on screen with present wait, otherwise when the present call returned
+};
+constexpr usz LATENCY_STAGE_COUNT = 5u;
+
+// steady_ns() of each stage, 0 when the frame did not reach it or it is unknown,
+// e.g. no input since the last packet or no swapchain to present to
+struct FrameTimestamps {
+	u64 input_ns = 0u;
+	u64 push_ns = 0u;
+	u64 pop_ns = 0u;
+	u64 submit_ns = 0u;
+	u64 present_ns = 0u;
+
+	auto at(LatencyStage stage) const -> u64;
+};
+
+struct LatencyPercentiles {
+	flt p50_ms = 0.0f;
+	flt p90_ms = 0.0f;
+	flt p99_ms = 0.0f;
+	flt max_ms = 0.0f;
+	usz samples = 0u; // frames that reached both stages
+};
+
+// Timestamps of the last `window` completed frames, with percentiles of the
+// time between any two stages. Never allocates after construction.
+class LatencyTracker {
+
+public:
+	explicit LatencyTracker(usz window = 600u);
+
+	void record(const FrameTimestamps& frame);
+	auto percentiles(LatencyStage from, LatencyStage to) const -> LatencyPercentiles;
+	// completed frames held, at most the window
+	auto size() const -> usz;
+	// 0 is the most recent frame
+	auto recent(usz age) const -> const FrameTimestamps&;
+
+private:
+	std::vector<FrameTimestamps> frames;
+	usz next = 0u;
+	usz count = 0u;
+	mutable std::vector<u64> scratch;
+};
+
+// GPU layout, keep in sync with src/shaders/latency_overlay.slang
+struct OverlayQuad {
+	glm::vec2 pos; // pixels from the bottom left corner of the target, y up
+	glm::vec2 size;
+	glm::vec4 color;
+};
+static_assert(sizeof(OverlayQuad) == 32u);
+
+// Bar graph of the last frames in the bottom left corner, one bar per frame
+// stacked from the time spent between consecutive stages, with a line every
+// 10 ms. Drawn inside the scene's rendering pass.
+class LatencyOverlay {
+
+public:
+	static constexpr u32 FRAMES = 128u;
+
+	LatencyOverlay(vk::Device dev, VulkanAllocator* alloc, vk::Format color_fmt, usz frames_in_flight);
+	~LatencyOverlay();
+
+	LatencyOverlay(const LatencyOverlay&) = delete;
+	LatencyOverlay& operator=(const LatencyOverlay&) = delete;
+
+	// writes the quads for the frames in the tracker, call once per frame after
+	// the fence of sync_idx has been waited on, outside of any rendering pass
+	void update(vk::CommandBuffer cmd, usz sync_idx, const LatencyTracker& tracker);
+	void draw(vk::CommandBuffer cmd, vk::Extent2D extent) const;
+
+private:
+	vk::Device dev;
+	VulkanAllocator* alloc;
+
+	std::vector<DynamicBuffer> quads{}; // per frame in flight
+	u32 quad_count = 0u;
+	usz sync_idx = 0u;
+
+	ShaderLayout layout;
+	vk::UniquePipeline pipeline;
+	vk::UniqueDescriptorPool descriptor_pool;
+	std::vector<vk::DescriptorSet> sets{};
+
+	auto build_pipeline(vk::Format color_fmt) const -> vk::UniquePipeline;
+};
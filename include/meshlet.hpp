@@ -0,0 +1,184 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include <glm/ext/matrix_float4x4.hpp>
+#include <glm/ext/vector_float3.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include "shader.hpp"
+#include "sugar.hpp"
+#include "vma.hpp"
+
+// limits of one cluster, the draw expands every visible one to MESHLET_MAX_TRIANGLES
+constexpr u32 MESHLET_MAX_VERTICES = 64u;
+constexpr u32 MESHLET_MAX_TRIANGLES = 124u;
+
+// GPU layouts, keep in sync with src/shaders/meshlet_cull.slang and meshlet_draw.slang
+
+struct MeshletVertex {
+	glm::vec3 pos;
+	u32 normal; // 10 bits per axis, unsigned, mapped from [-1, 1]
+};
+static_assert(sizeof(MeshletVertex) == 16u);
+
+// One cluster of at most MESHLET_MAX_TRIANGLES triangles at some level of detail.
+// A meshlet is drawn when its own error is small enough on screen and the error
+// of the coarser meshlets that replace it is not. Both are measured over spheres
+// that grow with the error, so exactly one level covers any part of the mesh.
+struct Meshlet {
+	glm::vec3 center; // bounding sphere of the triangles
+	flt radius;
+	glm::vec3 cone_apex; // backfacing when seen from anywhere inside the cone
+	flt cone_cutoff;     // 1 disables cone culling
+	glm::vec3 cone_axis;
+	flt lod_error; // object space distance the simplification moved vertices, 0 at full detail
+	glm::vec3 lod_center;
+	flt lod_radius;
+	glm::vec3 parent_center;
+	flt parent_radius;
+	flt parent_error;    // FLT_MAX when nothing replaces this meshlet
+	u32 vertex_offset;   // into MeshletMesh::meshlet_vertices
+	u32 triangle_offset; // into MeshletMesh::meshlet_triangles, in bytes
+	u32 triangle_count;
+};
+static_assert(sizeof(Meshlet) == 96u);
+
+struct MeshletCullParams {
+	glm::mat4 view_proj;
+	glm::vec3 camera;
+	flt proj_scale; // pixels per object space unit at distance 1
+	flt error_px;
+	flt znear;
+	u32 meshlet_count;
+	u32 pad;
+};
+static_assert(sizeof(MeshletCullParams) == 96u);
+
+struct MeshletDrawParams {
+	glm::mat4 view_proj;
+	glm::vec3 light_dir;
+	u32 show_clusters;
+};
+static_assert(sizeof(MeshletDrawParams) == 80u);
+
+// indexed triangles, as loaded from a model
+struct Mesh {
+	std::vector<glm::vec3> positions;
+	std::vector<u32> indices;
+};
+
+// meshlets of every level of detail, sharing one vertex buffer
+struct MeshletMesh {
+	std::vector<MeshletVertex> vertices;
+	std::vector<u32> meshlet_vertices;  // indices into vertices, per meshlet
+	std::vector<u8> meshlet_triangles;  // 3 indices into the meshlet's vertices per triangle, padded to 4 bytes
+	std::vector<Meshlet> meshlets;
+	glm::vec3 center{};
+	flt radius = 0.0f;
+	u32 lod_levels = 0u;
+	u64 triangles = 0u; // at full detail
+};
+
+// Splits the mesh into meshlets and builds a hierarchy of coarser ones on top:
+// each level groups neighbouring meshlets, simplifies every group with the
+// vertices on its border locked so neighbours can pick different levels without
+// cracks, and splits the result into meshlets again. Slow on large meshes, meant
+// to run offline with write_meshlet_container.
+auto build_meshlet_mesh(const Mesh& mesh) -> MeshletMesh;
+void write_meshlet_container(const std::string& path, const MeshletMesh& mesh);
+auto read_meshlet_container(const std::string& path) -> MeshletMesh;
+
+// bumpy torus with 2 * segments * segments / 2 triangles, for testing
+auto make_torus_mesh(u32 segments) -> Mesh;
+
+struct MeshletSettings {
+	flt error_px = 1.0f; // allowed screen space error of the selected level
+	flt fov_y = 0.8f;    // radians
+	flt orbit_speed = 0.2f; // radians per second of the camera around the mesh
+	bool show_clusters = false; // tints every meshlet differently
+};
+
+// Draws a MeshletMesh seen from a camera orbiting it. A compute pass picks the
+// level of detail per meshlet from its screen space error, culls meshlets
+// outside the frustum or facing away, and appends the rest to an instanced
+// indirect draw that expands each of them in the vertex shader.
+//
+// draw() records its own rendering pass with a depth buffer, so it runs before
+// the scene pass, which then has to load the color it wrote.
+class MeshletRenderer {
+
+public:
+	MeshletRenderer(
+		vk::Device dev,
+		VulkanAllocator* alloc,
+		const MeshletMesh& mesh,
+		vk::Format color_fmt,
+		vk::Format depth_fmt,
+		usz frames_in_flight,
+		MeshletSettings settings = {}
+	);
+	~MeshletRenderer();
+
+	MeshletRenderer(const MeshletRenderer&) = delete;
+	MeshletRenderer& operator=(const MeshletRenderer&) = delete;
+
+	// uploads the mesh on the first call and advances the camera, call once per
+	// frame after the fence of sync_idx has been waited on
+	void begin_frame(vk::CommandBuffer cmd, usz sync_idx, u64 frame, flt dt);
+	// culls for and draws into a color attachment in ColorAttachmentOptimal,
+	// outside of any rendering pass. Several targets may be drawn per frame.
+	void draw(vk::CommandBuffer cmd, vk::ImageView color, vk::Extent2D extent);
+
+private:
+	vk::Device dev;
+	VulkanAllocator* alloc;
+	MeshletSettings settings;
+	vk::Format depth_fmt;
+	usz frames_in_flight;
+	u32 meshlet_count;
+	glm::vec3 center;
+	flt radius;
+	flt orbit = 0.0f;
+
+	GpuBuffer* vertices = nullptr;
+	GpuBuffer* meshlet_vertices = nullptr;
+	GpuBuffer* meshlet_triangles = nullptr;
+	GpuBuffer* meshlets = nullptr;
+	GpuBuffer* visible = nullptr;   // indices of the meshlets drawn by draw_args
+	GpuBuffer* draw_args = nullptr; // vk::DrawIndirectCommand
+	GpuBuffer* staging = nullptr;   // mesh upload, freed once its frame has retired
+	u64 upload_frame = 0u;
+	bool uploaded = false;
+
+	GpuImage* depth = nullptr; // sized for the largest target so far
+	vk::UniqueImageView depth_view;
+	// outgrown depth buffers, which passes recorded earlier may still use, with
+	// the frame that last used them
+	struct RetiredDepth {
+		GpuImage* img;
+		vk::UniqueImageView view;
+		u64 frame;
+	};
+	std::vector<RetiredDepth> retired_depth{};
+
+	ShaderLayout cull_layout;
+	ShaderLayout draw_layout;
+	vk::UniquePipeline cull_pipeline;
+	vk::UniquePipeline draw_pipeline;
+	vk::UniqueDescriptorPool descriptor_pool;
+	// one of each per frame in flight, rewritten every frame since defragmentation
+	// may replace the buffer handles
+	std::vector<vk::DescriptorSet> cull_sets{};
+	std::vector<vk::DescriptorSet> draw_sets{};
+	usz sync_idx = 0u;
+	u64 frame = 0u;
+
+	void upload(vk::CommandBuffer cmd, u64 frame);
+	void ensure_depth(vk::Extent2D extent);
+	void write_sets(usz sync_idx);
+	auto build_cull() const -> vk::UniquePipeline;
+	auto build_draw(vk::Format color_fmt) const -> vk::UniquePipeline;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <vector>
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_float3.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include "shader.hpp"
+#include "sugar.hpp"
+#include "vma.hpp"
+
+// GPU layouts, keep in sync with src/shaders/particle_sim.slang
+
+struct Particle {
+	glm::vec3 pos;
+	flt life;
+	glm::vec3 vel;
+	flt size;
+};
+static_assert(sizeof(Particle) == 32u);
+
+struct ParticleCounters {
+	u32 count;
+	vk::DispatchIndirectCommand dispatch;
+	vk::DrawIndirectCommand draw;
+};
+static_assert(sizeof(ParticleCounters) == 32u);
+
+struct ParticleSimParams {
+	glm::vec3 emitter;
+	flt dt;
+	glm::vec3 gravity;
+	u32 emit_count;
+	u32 capacity;
+	u32 src;
+	u32 seed;
+	flt lifetime;
+};
+static_assert(sizeof(ParticleSimParams) == 48u);
+
+struct ParticleDrawParams {
+	glm::vec2 aspect;
+	flt lifetime;
+	flt pad;
+};
+
+struct ParticleSettings {
+	u32 capacity = 1u << 21;
+	flt emit_rate = 400'000.0f; // particles per second
+	flt lifetime = 4.0f;        // upper bound, each particle lives 50-100% of it
+	glm::vec3 emitter{0.0f, 0.6f, 0.0f};
+	glm::vec3 gravity{0.0f, 0.6f, 0.0f}; // clip space, positive y is down
+};
+
+// Compute driven particles: each frame emits new particles, simulates the live
+// ones and compacts the survivors into the other of two storage buffers, then
+// writes the indirect draw for them. Nothing goes through the CPU but the
+// emit count.
+//
+// simulate() may be recorded on a separate compute queue, in which case the
+// buffers are shared between the queue families and the graphics submission
+// has to wait for the compute one at DRAW_STAGES.
+class ParticleSystem {
+
+public:
+	static constexpr auto DRAW_STAGES = vk::PipelineStageFlagBits2::eDrawIndirect
+		| vk::PipelineStageFlagBits2::eVertexShader;
+
+	ParticleSystem(
+		vk::Device dev,
+		VulkanAllocator* alloc,
+		std::span<const u32> queue_families,
+		vk::Format color_fmt,
+		usz frames_in_flight,
+		ParticleSettings settings = {}
+	);
+	~ParticleSystem();
+
+	ParticleSystem(const ParticleSystem&) = delete;
+	ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+	// records one simulation step, call once per frame after the fence of sync_idx
+	// has been waited on. On the graphics queue it also makes the results visible
+	// to draw(), on a compute queue the semaphore wait does that.
+	void simulate(vk::CommandBuffer cmd, usz sync_idx, flt dt, bool graphics_queue);
+	// draws the results of the last simulate(), inside the scene's rendering pass
+	void draw(vk::CommandBuffer cmd, vk::Extent2D extent) const;
+
+private:
+	vk::Device dev;
+	VulkanAllocator* alloc;
+	ParticleSettings settings;
+
+	std::array<GpuBuffer*, 2> particles{};
+	GpuBuffer* counters = nullptr;
+	u32 src = 0u; // buffer simulated by the next step, holds the last step's results
+	flt emit_carry = 0.0f;
+	u32 seed = 0u;
+	bool initialized = false;
+
+	ShaderLayout sim_layout;
+	ShaderLayout draw_layout;
+	vk::UniquePipeline emit_pipeline;
+	vk::UniquePipeline simulate_pipeline;
+	vk::UniquePipeline finalize_pipeline;
+	vk::UniquePipeline draw_pipeline;
+	vk::UniqueDescriptorPool descriptor_pool;
+	// one of each per frame in flight, rewritten every frame since defragmentation
+	// may replace the buffer handles
+	std::vector<vk::DescriptorSet> sim_sets{};
+	std::vector<vk::DescriptorSet> draw_sets{};
+	vk::DescriptorSet draw_set{}; // written by the last simulate()
+
+	auto build_compute(const char* entry_point) const -> vk::UniquePipeline;
+	auto build_draw(vk::Format color_fmt) const -> vk::UniquePipeline;
+	void write_sets(usz sync_idx, u32 dst);
+};
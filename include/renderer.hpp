@@ -3,8 +3,10 @@
 #include <array>
 #include <glm/ext/vector_uint2.hpp>
 #include <optional>
+#include <span>
 #include <vector>
 
+#include <boost/lockfree/spsc_queue.hpp>
 #include <glm/ext/vector_int2.hpp>
 #include <SDL_video.h>
 #include <VkBootstrap.h>
@@ -13,33 +15,55 @@
 #include <vulkan/vulkan_structs.hpp>
 
 #include "arena.hpp"
+#include "draw.hpp"
+#include "hot_reload.hpp"
+#include "latency.hpp"
+#include "meshlet.hpp"
+#include "particles.hpp"
+#include "resolution.hpp"
+#include "shader.hpp"
 #include "sugar.hpp"
+#include "texture.hpp"
 #include "vma.hpp"
 
-struct DrawCommand {
-	// TODO
-};
-
 struct FramePacket {
 	flt t;
 	flt dt;
 	glm::ivec2 drawable_sz;
 	std::span<DrawCommand> commands;
+	std::span<const TextureUse> textures{}; // sampled this frame, streams in the mips they need
+	FrameTimestamps stamps{}; // input and push set by main, pop by the render loop, the rest by the renderer
 };
 
+// everything a frame allocates comes from the arena and is freed in bulk when
+// the context is reused
 struct FrameContext {
 	Arena arena;
-	FramePacket* pkt = nullptr;
+	ArenaResource memory{arena}; // for std::pmr containers
+	std::span<FramePacket*> pkts{}; // one per window, in the order the renderer was given them
 	FrameContext() : arena(1024 * 1024) {}
+
+	// memory points at this context's arena, so contexts stay where they were made
+	FrameContext(const FrameContext&) = delete;
+	FrameContext& operator=(const FrameContext&) = delete;
+	FrameContext(FrameContext&&) = delete;
+	FrameContext& operator=(FrameContext&&) = delete;
 };
 
+// main -> render thread handoff, and back once the frame has been recorded
+using FrameQueue = boost::lockfree::spsc_queue<FrameContext*, boost::lockfree::capacity<4>>;
+
 struct Window {
 	SDL_Window* inner;
 	glm::ivec2 sz{};
 	std::vector<const char*> required_exts{};
 
-	explicit Window();
+	// placed on the given display, wrapping around if there are fewer
+	explicit Window(u32 display = 0u);
 	~Window();
+
+	Window(const Window&) = delete;
+	Window& operator=(const Window&) = delete;
 };
 
 struct GPU {
@@ -47,6 +71,9 @@ struct GPU {
 	vk::PhysicalDeviceProperties props;
 	vk::PhysicalDeviceFeatures feats;
 	u32 qu_fam_idx;
+	bool has_mem_budget; // VK_EXT_memory_budget
+	std::optional<u32> compute_fam_idx; // separate compute-only family for async work
+	bool has_present_wait; // VK_KHR_present_id and VK_KHR_present_wait
 };
 
 struct RenderTarget {
@@ -56,7 +83,8 @@ struct RenderTarget {
 	u32 img_idx;
 };
 
-// it is the user's responsibility to recreate the swapchain upon receiving false/None
+// it is the user's responsibility to recreate the swapchain upon receiving false/None,
+// presenting is batched over all swapchains by the renderer
 class Swapchain {
 	friend class Renderer;
 
@@ -69,9 +97,7 @@ public:
 	);
 
 	bool recreate(glm::ivec2 sz);
-	bool present(vk::Queue qu);
 	auto acq_next_img(vk::Semaphore to_sig) -> std::optional<RenderTarget>;
-	auto base_barrier() const -> vk::ImageMemoryBarrier2;
 	auto get_size() const -> glm::ivec2;
 	auto get_sem() const -> vk::Semaphore;
 
@@ -88,47 +114,178 @@ private:
 
 };
 
+// color image owned by the renderer: the target when there is no window,
+// e.g. for benchmarks, and the reduced resolution scene with dynamic resolution
+struct Offscreen {
+	GpuImage* img;
+	vk::UniqueImageView view;
+};
+
 class Renderer {
 
 public:
+	// one swapchain per window, all driven by the same device and queue. Without
+	// windows the renderer runs headless and draws into an offscreen image.
+	explicit Renderer(std::span<Window* const> wins);
 	explicit Renderer(Window* win);
 	~Renderer();
 
+	// one packet per window, in the order the windows were given, or a single one
+	// when headless. All outputs are submitted together and presented with one call.
+	void draw(std::span<FramePacket* const> pkts);
 	void draw(FramePacket* pkt);
+	auto output_count() const -> usz;
+	void wait_idle();
+	// CPU time spent recording the last frame's command buffer
+	auto last_record_ns() const -> u64;
+	// GPU time of the most recently completed frame, 0 without timestamp support
+	auto last_gpu_ns() const -> u64;
+	// Renders the scene at a reduced internal resolution, chosen to hold ms of GPU
+	// time per frame, and upscales it to the output. nullopt renders at full size.
+	void set_target_frame_time(std::optional<flt> ms);
+	// internal resolution as a fraction of the output size per axis
+	auto render_scale() const -> flt;
+	// compute driven particles drawn on top of the scene, on the async compute queue if there is one
+	void enable_particles(const ParticleSettings& settings = {});
+	// meshlet clusters with per-cluster LOD drawn under the scene, from a camera orbiting them
+	void enable_meshlets(const MeshletMesh& mesh, const MeshletSettings& settings = {});
+	// render thread only
+	auto textures() -> TextureStreamer&;
+	// timestamps of the last presented frames, render thread only. With present
+	// wait the present stage is when the image reached the screen.
+	auto latency() const -> const LatencyTracker&;
+	// bar graph of the last frames' latency in the bottom left corner
+	void show_latency_overlay(bool show);
+	// checks which presents have reached the screen, draw() does too, but calling
+	// it while waiting for the next packet times them more closely
+	void poll_presents();
 
 private:
 	struct RenderSync {
 		vk::CommandBuffer cmd;
-		vk::UniqueSemaphore img_sem; // signalled when img acquired
 		vk::UniqueFence drawn;
+		bool timed = false; // the last submission wrote this slot's timestamps
+		// async particle step, only with a separate compute family
+		vk::CommandBuffer compute_cmd;
+		vk::UniqueSemaphore simulated;
+	};
+
+	// frames waiting for their presents to reach the screen, by img_idx
+	static constexpr usz PENDING_FRAMES = 8u;
+
+	// vertex data triangle.slang reads, in geometry memory that defragmentation may move
+	struct SceneGeometry {
+		GpuBuffer* pos = nullptr;
+		GpuBuffer* color = nullptr;
+		GpuBuffer* staging = nullptr; // copied by the first frame, freed once that has retired
+		u64 upload_frame = 0u;
+		bool uploaded = false;
+		vk::UniqueDescriptorPool descriptor_pool;
+		vk::DescriptorSet set; // cached groups bind it, so it is replaced rather than rewritten
+		std::array<vk::Buffer, 2> set_bufs{}; // pos and color handles the set points at
+		std::vector<std::pair<u64, vk::DescriptorSet>> retired_sets{}; // frame they were replaced in
+	};
+
+	struct PendingFrame {
+		FrameTimestamps stamps{};
+		u32 outstanding = 0u; // presents not seen on screen yet
+		bool dropped = false; // one of them never will be, e.g. its swapchain was recreated
 	};
 
-	auto init_inst(Window* win) -> vkb::Instance;
+	// a window's swapchain, or the offscreen image when headless
+	struct Output {
+		vk::UniqueSurfaceKHR surf; // null when headless
+		std::optional<Swapchain> swapchain{};
+		std::vector<vk::UniqueSemaphore> img_sems{}; // per render_sync slot, signalled when img acquired
+		bool stale = false; // the last present asked for recreation
+		std::optional<Offscreen> offscreen{};
+		// output sized, the scene is drawn into its top left corner at the controller's scale
+		std::optional<Offscreen> scene{};
+		std::optional<RenderTarget> target{}; // acquired for the frame being recorded
+		std::array<u64, PENDING_FRAMES> present_ids{}; // per pending frame, 0 when not waited on
+	};
+
+	auto init_inst(std::span<Window* const> wins) -> vkb::Instance;
 	void init_devs(vkb::Instance vkb_inst);
 	void init_sync();
 	void init_pipeline();
+	void init_scene_geometry();
+	void update_scene_geometry(vk::CommandBuffer cmd);
+	auto build_pipeline(std::span<const u32> spirv, vk::Format color_fmt) const -> vk::UniquePipeline;
+	void swap_reloaded_pipelines();
 
-	auto acq_render_target(RenderSync* sync, FramePacket* pkt) -> std::optional<RenderTarget>;
-	void transition_for_render(vk::CommandBuffer cmd) const;
+	auto color_fmt() const -> vk::Format;
+	auto acq_render_targets(usz sync_idx, std::span<FramePacket* const> pkts) -> bool;
+	auto acq_render_target(Output& output, usz sync_idx, FramePacket* pkt) -> std::optional<RenderTarget>;
+	auto acq_offscreen(Output& output, glm::ivec2 sz) -> RenderTarget;
+	auto acq_scene_target(Output& output, vk::Extent2D extent) -> RenderTarget;
+	auto create_color_target(vk::Extent2D extent, vk::ImageUsageFlags usage) -> Offscreen;
+	void destroy_color_target(std::optional<Offscreen>& target);
+	void read_gpu_time(usz sync_idx);
+	auto target_barrier(const RenderTarget& img) const -> vk::ImageMemoryBarrier2;
+	void transition_for_render(const RenderTarget& img, vk::CommandBuffer cmd) const;
+	void record_output(Output& output, vk::CommandBuffer cmd, FramePacket* pkt);
 	void render(RenderTarget& img, vk::CommandBuffer cmd, FramePacket* pkt);
-	void transition_for_present(vk::CommandBuffer cmd) const;
-	void submit_and_present(RenderSync* sync);
+	void record_draws(vk::CommandBuffer cmd, vk::Extent2D extent, std::span<const DrawCommand> commands) const;
+	void upscale(const RenderTarget& scene, const RenderTarget& img, vk::CommandBuffer cmd) const;
+	void transition_for_present(const Output& output, vk::ImageLayout from, vk::CommandBuffer cmd) const;
+	void simulate_async(RenderSync* sync, usz sync_idx, flt dt);
+	void submit_and_present(RenderSync* sync, usz sync_idx, const FrameTimestamps& stamps);
+	void present(FrameTimestamps stamps);
+	void drop_pending_presents(Output& output);
+	void manage_memory(usz sync_idx, vk::CommandBuffer cmd);
 
 	vk::UniqueInstance inst;
-	vk::UniqueSurfaceKHR surf;
 
 	GPU gpu;
 	vk::UniqueDevice dev;
 	vk::Queue qu;
+	vk::Queue compute_qu; // null without a separate compute family
 
-	std::optional<Swapchain> swapchain{};
+	// never empty, color targets are destroyed by ~Renderer before the allocator
+	std::vector<Output> outputs{};
 
 	vk::UniqueCommandPool render_cmd_pool;
+	vk::UniqueCommandPool compute_cmd_pool;
 	std::array<RenderSync, 2> render_sync{};
+	std::optional<DrawCache> draw_cache{};
+	std::vector<vk::CommandBuffer> secondaries{}; // executed by the current frame, reused to avoid allocating
+	// batched submit and present of all outputs, reused like secondaries
+	std::vector<vk::SemaphoreSubmitInfo> submit_waits{};
+	std::vector<vk::SemaphoreSubmitInfo> submit_signals{};
+	std::vector<vk::SwapchainKHR> present_swapchains{};
+	std::vector<u32> present_idxs{};
+	std::vector<vk::Semaphore> present_sems{};
+	std::vector<vk::Result> present_results{};
+	std::vector<Output*> presented{};
+	std::vector<u64> present_id_values{};
+	std::array<PendingFrame, PENDING_FRAMES> pending_frames{};
+	u64 last_present_id{0}; // ids only have to increase per swapchain, one counter serves all
+	LatencyTracker latency_tracker{};
 	u64 img_idx{0};
+	u64 record_ns{0};
+
+	// start and end timestamp per render_sync slot, null when the queue cannot write them
+	vk::UniqueQueryPool timestamps;
+	u64 timestamp_mask{0}; // valid bits of a timestamp
+	u64 gpu_ns{0};
 
 	VulkanAllocator alloc;
-	vk::UniquePipelineLayout pipeline_layout;
+	std::optional<ResolutionController> dynres{}; // one scale for all outputs
+	std::optional<TextureStreamer> texture_streamer{};
+	std::optional<ParticleSystem> particles{};
+	std::optional<MeshletRenderer> meshlets{};
+	std::optional<LatencyOverlay> latency_overlay{};
+	std::optional<usz> defrag_slot{}; // render_sync slot whose submission carries the open defrag pass
+	ShaderLayout layout;
+	SceneGeometry scene{};
 	vk::UniquePipeline pipeline;
+	vk::Format pipeline_fmt = vk::Format::eUndefined; // color format the pipeline was built for
+
+#ifdef VK_SHADER_HOT_RELOAD
+	// replaced pipelines, destroyed once the last frame using them has retired
+	std::vector<std::pair<u64, vk::UniquePipeline>> retired_pipelines{};
+	std::unique_ptr<ShaderWatcher> watcher{};
+#endif
 
 };
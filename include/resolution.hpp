@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "sugar.hpp"
+
+// Picks the internal render scale (a fraction of the output size per axis)
+// that holds a target GPU frame time. The GPU cost of a frame is assumed to
+// scale with the pixel count, so a frame that is 4x over budget asks for half
+// the resolution per axis.
+class ResolutionController {
+
+public:
+	explicit ResolutionController(flt target_ms, flt min_scale = 0.5f, flt max_scale = 1.0f);
+
+	// feeds the measured GPU time of a finished frame, returns the scale for the next one
+	auto update(flt gpu_ms) -> flt;
+	auto scale() const -> flt;
+	auto target_ms() const -> flt;
+	// internal render size for an output of the given size, never zero
+	auto extent(vk::Extent2D output) const -> vk::Extent2D;
+
+private:
+	flt target;
+	flt min_scale;
+	flt max_scale;
+	flt cur_scale;
+	flt avg_ms = 0.0f; // exponential moving average, 0 until the first sample
+	u32 settle = 0u;   // samples to skip, timings lag behind scale changes
+
+};
@@ -1,6 +1,105 @@
 #pragma once
 
+#include <array>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include <vulkan/vulkan.hpp>
+
+#include "sugar.hpp"
+
 auto read_file(std::string name) -> std::vector<char>;
+
+struct ShaderEntryPoint {
+	std::string_view name;
+	vk::ShaderStageFlagBits stage;
+};
+
+struct ShaderBinding {
+	std::string_view name;
+	u32 set;
+	u32 binding;
+	vk::DescriptorType type;
+	u32 count;
+};
+
+struct ShaderPushConstant {
+	std::string_view name;
+	u32 offset;
+	u32 size;
+};
+
+// compiled shader embedded by target_slang_shaders, see cmake/embed_shader.cmake
+template<usz WORDS, usz ENTRY_POINTS, usz BINDINGS, usz PUSH_CONSTANTS>
+struct ShaderModule {
+	std::array<u32, WORDS> spirv;
+	vk::ShaderStageFlags stages;
+	std::array<ShaderEntryPoint, ENTRY_POINTS> entry_points;
+	std::array<ShaderBinding, BINDINGS> bindings;
+	std::array<ShaderPushConstant, PUSH_CONSTANTS> push_constants;
+
+	// throws (a compile error in constant evaluation) when the shader has no such stage
+	constexpr auto entry_point(vk::ShaderStageFlagBits stage) const -> const char* {
+		for (auto& ep : this->entry_points) {
+			if (ep.stage == stage) return ep.name.data();
+		}
+		throw std::logic_error("shader has no entry point for stage");
+	}
+
+	// for modules with several entry points of the same stage, e.g. compute passes
+	constexpr auto entry_point(std::string_view name) const -> const char* {
+		for (auto& ep : this->entry_points) {
+			if (ep.name == name) return ep.name.data();
+		}
+		throw std::logic_error("shader has no such entry point");
+	}
+
+	// throws (a compile error in constant evaluation) when the shader has no such parameter
+	constexpr auto binding(std::string_view name) const -> const ShaderBinding& {
+		for (auto& b : this->bindings) {
+			if (b.name == name) return b;
+		}
+		throw std::logic_error("shader has no such binding");
+	}
+};
+
+struct ShaderLayout {
+	std::vector<vk::UniqueDescriptorSetLayout> set_layouts;
+	vk::UniquePipelineLayout pipeline_layout;
+};
+
+auto create_shader_layout(
+	vk::Device dev,
+	vk::ShaderStageFlags stages,
+	std::span<const ShaderBinding> bindings,
+	std::span<const ShaderPushConstant> push_constants
+) -> ShaderLayout;
+
+// Throws when SPIR-V built from a changed source no longer fits the layout
+// reflected at build time: an entry point is gone, or a descriptor the code
+// declares has no binding of a compatible type. Push constant sizes are not compared.
+void require_matching_interface(
+	std::span<const u32> spirv,
+	std::span<const ShaderEntryPoint> entry_points,
+	std::span<const ShaderBinding> bindings,
+	std::span<const ShaderPushConstant> push_constants
+);
+
+template<usz WORDS, usz ENTRY_POINTS, usz BINDINGS, usz PUSH_CONSTANTS>
+void require_matching_interface(
+	const ShaderModule<WORDS, ENTRY_POINTS, BINDINGS, PUSH_CONSTANTS>& module,
+	std::span<const u32> spirv
+) {
+	require_matching_interface(spirv, module.entry_points, module.bindings, module.push_constants);
+}
+
+template<usz WORDS, usz ENTRY_POINTS, usz BINDINGS, usz PUSH_CONSTANTS>
+auto create_shader_layout(
+	vk::Device dev,
+	const ShaderModule<WORDS, ENTRY_POINTS, BINDINGS, PUSH_CONSTANTS>& module
+) -> ShaderLayout {
+	return create_shader_layout(dev, module.stages, module.bindings, module.push_constants);
+}
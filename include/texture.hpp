@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "sugar.hpp"
+#include "vma.hpp"
+
+// Pre-baked texture container, laid out to be memory mapped and streamed:
+// TexHeader, TexMip[mip_count], then block-compressed mip data.
+// The mip table and the data are stored coarsest mip first, so the mips
+// that are uploaded right away sit together at the front of the file.
+struct TexHeader {
+	std::array<char, 4> magic; // "VKTX"
+	u32 version;
+	u32 format; // VkFormat, normally a BCn format
+	u32 width;
+	u32 height;
+	u32 mip_count;
+};
+
+struct TexMip {
+	u64 offset; // from the start of the file, aligned to TEX_DATA_ALIGN
+	u64 size;
+	u32 width;
+	u32 height;
+};
+
+constexpr u64 TEX_DATA_ALIGN = 256u;
+
+// one already compressed mip level, finest first as in Vulkan
+struct TexMipData {
+	u32 width;
+	u32 height;
+	std::span<const std::byte> data;
+};
+
+void write_texture_container(const std::string& path, vk::Format fmt, std::span<const TexMipData> mips);
+
+// read-only memory mapping of a whole file
+class MappedFile {
+
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	auto bytes() const -> std::span<const std::byte>;
+
+private:
+	std::byte* ptr = nullptr;
+	usz size = 0u;
+
+};
+
+using TextureHandle = u32;
+
+// a texture drawn in a frame, covering up to screen_px pixels along its largest axis
+struct TextureUse {
+	TextureHandle tex;
+	flt screen_px;
+};
+
+// Keeps the coarse mip tail of every loaded texture resident and streams finer
+// mips in as they are used on screen, within a VRAM budget, evicting the least
+// recently used textures first. Render thread only.
+//
+// Residency changes recreate the image with the new mip range, copy the levels
+// the old image held and upload only the new ones from the mapped file. A
+// level larger than a frame's upload allowance is spread over several frames,
+// the old image stays in use meanwhile. view() changes whenever mips come or go.
+class TextureStreamer {
+
+public:
+	TextureStreamer(vk::Device dev, VulkanAllocator* alloc, u64 budget, usz frames_in_flight);
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// nothing is uploaded until the next update()
+	auto load(const std::string& path) -> TextureHandle;
+	// the texture covers up to screen_px pixels along its largest axis, taken
+	// into account by the next update()
+	void mark_used(TextureHandle tex, flt screen_px);
+	// records uploads, call once per frame after the fence of sync_idx has been waited on
+	void update(vk::CommandBuffer cmd, usz sync_idx, u64 frame);
+
+	// null until the mip tail has been uploaded
+	auto view(TextureHandle tex) const -> vk::ImageView;
+	// finest resident mip level
+	auto resident_mip(TextureHandle tex) const -> std::optional<u32>;
+	auto resident_bytes() const -> u64;
+	void set_budget(u64 bytes);
+
+private:
+	struct Texture {
+		MappedFile file;
+		const TexHeader* header;
+		std::span<const TexMip> mips; // coarsest first
+		u32 tail;     // finest level that is always resident
+		u32 resident; // finest resident level, mip_count when nothing is
+		u32 wanted;   // finest level requested in the frame it was last used
+		u64 last_used = 0u;
+		std::optional<u32> marked{}; // finest level requested since the last update()
+		GpuImage* img = nullptr;
+		vk::UniqueImageView view{};
+		GpuImage* next = nullptr; // replaces img once the levels it adds are uploaded
+		u32 next_lvl = 0u;        // finest level of next
+		u32 pending_levels = 0u;  // levels of next still to upload, they are the finest ones
+		u32 pending_rows = 0u;    // block rows of the coarsest of those already uploaded
+	};
+
+	struct Retired {
+		u64 frame;
+		GpuImage* img;
+		vk::UniqueImageView view;
+	};
+
+	vk::Device dev;
+	VulkanAllocator* alloc;
+	u64 budget;
+	u64 resident_total = 0u;
+	usz frames_in_flight;
+	std::vector<Texture> textures{};
+	std::vector<Retired> retired{};
+	// update() scratch, kept to not allocate every frame
+	std::vector<Texture*> growing{};
+	std::vector<vk::ImageCopy> copy_regions{};
+	std::vector<vk::BufferImageCopy> upload_regions{};
+	std::vector<GpuBuffer*> staging{}; // one per frame in flight
+
+	auto level(const Texture& tex, u32 lvl) const -> const TexMip&;
+	auto bytes_from(const Texture& tex, u32 lvl) const -> u64;
+	auto block_rows(const Texture& tex, u32 lvl) const -> u32;
+	void begin_residency(Texture& tex, u32 lvl, vk::CommandBuffer cmd);
+	auto upload_pending(Texture& tex, vk::CommandBuffer cmd, GpuBuffer* staging, u64& staging_ofs) -> bool;
+	void finish_residency(Texture& tex, vk::CommandBuffer cmd, u64 frame);
+	void cancel_residency(Texture& tex, u64 frame);
+
+};
@@ -1,16 +1,156 @@
 #pragma once
 
+#include <array>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan.hpp>
 
+#include "sugar.hpp"
+
+// every resource class gets its own pool so heap pressure can be attributed
+// and each class can be defragmented on its own
+enum class PoolKind : u8 {
+	Geometry, // device-local vertex/index/storage buffers
+	Staging,  // host-visible upload sources
+	Texture,  // sampled images
+	Dynamic,  // rewritten by the CPU every frame, see DynamicBuffer
+};
+constexpr usz POOL_KIND_COUNT = 4u;
+
+struct HeapBudget {
+	u32 heap_idx;
+	vk::MemoryHeapFlags flags;
+	u64 usage;     // bytes used by this process on the heap (driver-reported with VK_EXT_memory_budget)
+	u64 budget;    // bytes we can use before the driver starts paging
+	u64 block_bytes; // bytes held in VMA blocks
+	u64 alloc_bytes; // bytes handed out to allocations
+	u32 blocks;
+	u32 allocs;
+};
+
+// buf is swapped out when the allocation is moved by defragmentation,
+// so fetch it each frame instead of caching the handle
+struct GpuBuffer {
+	vk::Buffer buf;
+	VmaAllocation alloc = VK_NULL_HANDLE;
+	vk::DeviceSize size = 0u;
+	vk::BufferUsageFlags usage;
+	PoolKind pool;
+	void* mapped = nullptr;
+	bool shared = false; // concurrent across queue families, never moved by defragmentation
+};
+
+// Data the CPU rewrites every frame for the GPU to read. When some memory is
+// both device-local and host-visible (resizable BAR, UMA) the CPU writes the
+// buffer the GPU reads in place, otherwise it writes a staging buffer that
+// upload_dynamic() copies over. Keep one per frame in flight, a frame's writes
+// must not touch a buffer an earlier frame may still be reading.
+struct DynamicBuffer {
+	GpuBuffer* gpu = nullptr;     // bind this one, it is never moved by defragmentation
+	GpuBuffer* staging = nullptr; // null when gpu is written in place
+	void* mapped = nullptr;       // where the CPU writes
+};
+
+struct GpuImage {
+	vk::Image img;
+	VmaAllocation alloc = VK_NULL_HANDLE;
+	vk::Extent3D extent;
+	vk::Format fmt;
+	u32 mip_levels = 1u;
+};
+
 struct VulkanAllocator {
-	VmaAllocator inner;
+	VmaAllocator inner = VK_NULL_HANDLE;
 
 	VulkanAllocator();
 	VulkanAllocator(
 		vk::Instance const inst,
 		vk::PhysicalDevice const pdev,
-		vk::Device const dev
+		vk::Device const dev,
+		bool has_mem_budget
 	);
 	~VulkanAllocator();
+
+	VulkanAllocator(const VulkanAllocator&) = delete;
+	VulkanAllocator& operator=(const VulkanAllocator&) = delete;
+
+	VulkanAllocator(VulkanAllocator&& other) noexcept;
+	VulkanAllocator& operator=(VulkanAllocator&& other) noexcept;
+
+	// lets VMA refresh its budget numbers, call once per frame
+	void set_frame_idx(u32 frame_idx);
+
+	// allocations fail instead of exceeding the heap budget
+	// with more than one queue family the buffer is shared between them
+	auto create_buffer(
+		PoolKind pool,
+		vk::DeviceSize size,
+		vk::BufferUsageFlags usage,
+		std::span<const u32> queue_families = {}
+	) -> GpuBuffer*;
+	void destroy_buffer(GpuBuffer* buf);
+	// makes host writes to a mapped buffer visible, host-visible memory is not always coherent
+	void flush(GpuBuffer* buf, vk::DeviceSize ofs, vk::DeviceSize size);
+
+	// whether DynamicBuffers are written in place, fixed at creation
+	auto dynamic_writes_direct() const -> bool;
+	auto create_dynamic_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage) -> DynamicBuffer;
+	void destroy_dynamic_buffer(DynamicBuffer& buf);
+	// Makes the first size bytes written through mapped visible to the GPU from
+	// dst_stages on. Written in place that is a flush, otherwise the copy from
+	// staging and its barrier are recorded into cmd, outside any rendering pass.
+	void upload_dynamic(
+		vk::CommandBuffer cmd,
+		const DynamicBuffer& buf,
+		vk::DeviceSize size,
+		vk::PipelineStageFlags2 dst_stages,
+		vk::AccessFlags2 dst_access
+	);
+
+	// images whose requirements exclude the pool's memory type are allocated outside it
+	auto create_image(PoolKind pool, const vk::ImageCreateInfo& cinfo) -> GpuImage*;
+	// attachments get dedicated memory outside the pools, they are large and rarely freed
+	auto create_render_target(const vk::ImageCreateInfo& cinfo) -> GpuImage*;
+	void destroy_image(GpuImage* img);
+
+	auto heap_budgets() const -> std::vector<HeapBudget>;
+	// highest usage/budget ratio over all heaps
+	auto heap_pressure() const -> flt;
+	void print_budgets(std::ostream& out) const;
+	auto stats_json(bool detailed) const -> std::string;
+
+	// Incremental defragmentation of one pool. Each pass is recorded into the
+	// frame's command buffer and must only be finished once that submission
+	// has completed. Only unshared GpuBuffers are moved, other queues could be
+	// using shared ones while the copy runs. Anything else is left in place.
+	void begin_defrag(PoolKind pool);
+	auto defrag_active() const -> bool;
+	void record_defrag_pass(vk::CommandBuffer cmd);
+	void finish_defrag_pass();
+
+private:
+	struct Defrag {
+		VmaDefragmentationContext ctx = VK_NULL_HANDLE;
+		VmaDefragmentationPassMoveInfo pass{};
+		bool pass_open = false;
+		std::vector<vk::Buffer> retired{};
+		std::vector<GpuBuffer*> moved{};
+	};
+
+	vk::Device dev;
+	std::array<VmaPool, POOL_KIND_COUNT> pools{};
+	std::array<u32, POOL_KIND_COUNT> pool_types{}; // memory type of each pool
+	bool dynamic_direct = false; // the Dynamic pool is host-visible
+	std::vector<std::unique_ptr<GpuBuffer>> bufs{};
+	std::vector<std::unique_ptr<GpuImage>> imgs{};
+	Defrag defrag{};
+
+	void init_pools();
+	auto create_image(const vk::ImageCreateInfo& cinfo, const VmaAllocationCreateInfo& alloc_info) -> GpuImage*;
+	void destroy();
 };
@@ -0,0 +1,114 @@
+// Replays a frame capture written by `vk --capture <file>` through the renderer.
+//
+// vk_replay <capture> [--rate <hz>] [--loops <n>] [--headless]
+//
+// Without --rate frames are drawn as fast as the renderer accepts them.
+// Packets are replayed verbatim, including their recorded t/dt, so runs are repeatable.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SDL.h>
+
+#include "arena.hpp"
+#include "capture.hpp"
+#include "renderer.hpp"
+#include "sugar.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+static auto percentile(std::vector<dbl> samples, dbl p) -> dbl {
+	if (samples.empty()) return 0.0;
+	auto idx = std::min(static_cast<usz>(p * static_cast<dbl>(samples.size())), samples.size() - 1u);
+	std::nth_element(samples.begin(), samples.begin() + static_cast<isz>(idx), samples.end());
+	return samples[idx];
+}
+
+int main(int argc, char** argv) {
+	auto path = std::string{};
+	auto rate = std::optional<dbl>{};
+	u64 loops = 1u;
+	auto headless = false;
+
+	for (int i = 1; i < argc; i++) {
+		auto arg = std::string(argv[i]);
+		auto next = [&]() -> std::string {
+			if (i + 1 >= argc) {
+				std::cerr << arg << " needs a value" << std::endl;
+				std::exit(2);
+			}
+			return argv[++i];
+		};
+		if (arg == "--rate") rate = std::stod(next());
+		else if (arg == "--loops") loops = std::stoull(next());
+		else if (arg == "--headless") headless = true;
+		else if (path.empty()) path = arg;
+		else {
+			std::cerr << "unknown argument " << arg << std::endl;
+			return 2;
+		}
+	}
+	if (path.empty()) {
+		std::cerr << "usage: vk_replay <capture> [--rate <hz>] [--loops <n>] [--headless]" << std::endl;
+		return 2;
+	}
+
+	auto reader = PacketReader(path);
+	auto win = std::unique_ptr<Window>{};
+	if (!headless) {
+		win = std::make_unique<Window>();
+	}
+	auto renderer = Renderer(win.get());
+	auto arena = Arena(16 * 1024 * 1024);
+
+	auto draw_ms = std::vector<dbl>{};
+	auto record_ms = std::vector<dbl>{};
+	auto start = clock_type::now();
+	auto deadline = start;
+
+	for (u64 loop = 0u; loop < loops; loop++) {
+		reader.rewind();
+		while (true) {
+			arena.reset();
+			auto pkt = reader.next(arena);
+			if (pkt == nullptr) break;
+
+			if (win != nullptr) {
+				// keep the window responsive, input is ignored
+				SDL_PumpEvents();
+			}
+
+			if (rate.has_value()) {
+				deadline += std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<dbl>(1.0 / *rate));
+				std::this_thread::sleep_until(deadline);
+			}
+
+			auto t0 = clock_type::now();
+			renderer.draw(pkt);
+			std::chrono::duration<dbl, std::milli> elapsed = clock_type::now() - t0;
+			draw_ms.push_back(elapsed.count());
+			record_ms.push_back(static_cast<dbl>(renderer.last_record_ns()) / 1e6);
+		}
+	}
+	renderer.wait_idle();
+	std::chrono::duration<dbl> total = clock_type::now() - start;
+
+	auto frames = draw_ms.size();
+	std::cout << "replayed " << frames << " frames in " << total.count() << " s"
+		<< " (" << static_cast<dbl>(frames) / total.count() << " fps)" << std::endl;
+	std::cout << "draw ms:   median " << percentile(draw_ms, 0.5)
+		<< ", p90 " << percentile(draw_ms, 0.9)
+		<< ", p99 " << percentile(draw_ms, 0.99)
+		<< ", max " << percentile(draw_ms, 1.0) << std::endl;
+	std::cout << "record ms: median " << percentile(record_ms, 0.5)
+		<< ", p90 " << percentile(record_ms, 0.9)
+		<< ", p99 " << percentile(record_ms, 0.99)
+		<< ", max " << percentile(record_ms, 1.0) << std::endl;
+}
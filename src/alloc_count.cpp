@@ -0,0 +1,60 @@
+#include "alloc_count.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef VK_COUNT_ALLOCS
+
+static thread_local u64 heap_allocs = 0u;
+
+// the remaining forms (nothrow, arrays) forward to these by default
+void* operator new(usz size) {
+	heap_allocs++;
+	if (void* ptr = std::malloc(size == 0u ? 1u : size)) return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new(usz size, std::align_val_t align) {
+	heap_allocs++;
+	auto alignment = static_cast<usz>(align);
+	// aligned_alloc wants a multiple of the alignment
+	auto rounded = (size + alignment - 1u) / alignment * alignment;
+	if (void* ptr = std::aligned_alloc(alignment, rounded == 0u ? alignment : rounded)) return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, usz) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, usz, std::align_val_t) noexcept {
+	std::free(ptr);
+}
+
+auto thread_heap_allocs() -> u64 {
+	return heap_allocs;
+}
+
+#else
+
+auto thread_heap_allocs() -> u64 {
+	return 0u;
+}
+
+#endif
+
+void expect_no_heap_allocs(u64 since, const char* what) {
+	auto count = thread_heap_allocs() - since;
+	if (count == 0u) return;
+	std::fprintf(stderr, "%llu heap allocations in %s\n", static_cast<unsigned long long>(count), what);
+	std::abort();
+}
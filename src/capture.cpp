@@ -0,0 +1,125 @@
+#include "capture.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include "sugar.hpp"
+
+static_assert(std::endian::native == std::endian::little, "captures are stored little endian");
+static_assert(std::is_trivially_copyable_v<DrawCommand>, "draw commands are captured as raw bytes");
+
+constexpr auto MAGIC = std::array{'V', 'K', 'P', 'K'};
+constexpr u32 VERSION = 1u;
+
+// most frames draw the same thing as the one before, so those only store the header
+constexpr u8 REPEAT_COMMANDS = 1u << 0u;
+
+template<typename T>
+static void put(std::ofstream& out, const T& value) {
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+static auto get(std::ifstream& in, T& value) -> bool {
+	return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+PacketRecorder::PacketRecorder(const std::string& path) : out(path, std::ios::binary | std::ios::trunc) {
+	if (!this->out.is_open()) throw std::runtime_error("failed to open capture file for writing");
+	this->out.write(MAGIC.data(), MAGIC.size());
+	put(this->out, VERSION);
+}
+
+void PacketRecorder::write(const FramePacket& pkt) {
+	auto repeat = std::equal(
+		pkt.commands.begin(), pkt.commands.end(),
+		this->prev_commands.begin(), this->prev_commands.end(),
+		[](const DrawCommand& a, const DrawCommand& b) { return std::memcmp(&a, &b, sizeof(DrawCommand)) == 0; }
+	);
+
+	put(this->out, static_cast<u8>(repeat ? REPEAT_COMMANDS : 0u));
+	put(this->out, pkt.t);
+	put(this->out, pkt.dt);
+	put(this->out, pkt.drawable_sz.x);
+	put(this->out, pkt.drawable_sz.y);
+	if (!repeat) {
+		put(this->out, cast<u32>(pkt.commands.size()));
+		this->out.write(reinterpret_cast<const char*>(pkt.commands.data()), pkt.commands.size_bytes());
+		this->prev_commands.assign(pkt.commands.begin(), pkt.commands.end());
+	}
+
+	if (!this->out) throw std::runtime_error("failed to write capture");
+	this->frame_count++;
+}
+
+auto PacketRecorder::frames() const -> u64 {
+	return this->frame_count;
+}
+
+PacketReader::PacketReader(const std::string& path) : in(path, std::ios::binary) {
+	if (!this->in.is_open()) throw std::runtime_error("failed to open capture file");
+
+	auto magic = std::array<char, MAGIC.size()>{};
+	u32 version = 0u;
+	this->in.read(magic.data(), magic.size());
+	if (!this->in || magic != MAGIC || !get(this->in, version)) {
+		throw std::runtime_error("not a frame capture");
+	}
+	if (version != VERSION) {
+		throw std::runtime_error("unsupported frame capture version");
+	}
+	this->first_frame = this->in.tellg();
+
+	this->in.seekg(0, std::ios::end);
+	this->file_size = static_cast<u64>(this->in.tellg());
+	this->in.seekg(this->first_frame);
+}
+
+auto PacketReader::next(Arena& arena) -> FramePacket* {
+	u8 flags = 0u;
+	if (!get(this->in, flags)) return nullptr;
+
+	auto pkt = arena.alloc<FramePacket>();
+	auto ok = get(this->in, pkt->t)
+		&& get(this->in, pkt->dt)
+		&& get(this->in, pkt->drawable_sz.x)
+		&& get(this->in, pkt->drawable_sz.y);
+
+	if (ok && !(flags & REPEAT_COMMANDS)) {
+		u32 count = 0u;
+		ok = get(this->in, count);
+		// a corrupt count must not turn into a huge allocation before the read fails
+		if (ok && u64{count} * sizeof(DrawCommand) > this->file_size - static_cast<u64>(this->in.tellg())) {
+			throw std::runtime_error("corrupt frame capture, draw commands run past the end of the file");
+		}
+		if (ok) {
+			this->prev_commands.resize(count);
+			ok = static_cast<bool>(this->in.read(
+				reinterpret_cast<char*>(this->prev_commands.data()),
+				count * sizeof(DrawCommand)
+			));
+		}
+	}
+	if (!ok) throw std::runtime_error("truncated frame capture");
+
+	// the renderer sorts in place, so hand out a copy
+	pkt->commands = arena.alloc_array<DrawCommand>(this->prev_commands.size());
+	std::copy(this->prev_commands.begin(), this->prev_commands.end(), pkt->commands.begin());
+
+	this->frame_count++;
+	return pkt;
+}
+
+void PacketReader::rewind() {
+	this->in.clear();
+	this->in.seekg(this->first_frame);
+	this->prev_commands.clear();
+}
+
+auto PacketReader::frames() const -> u64 {
+	return this->frame_count;
+}
@@ -0,0 +1,140 @@
+#include "draw.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+
+// groups that have not been drawn for this many frames are recycled
+static constexpr u64 EVICT_AFTER = 60u;
+
+void sort_draw_commands(std::span<DrawCommand> commands) {
+	std::sort(commands.begin(), commands.end(), [](const DrawCommand& a, const DrawCommand& b) {
+		return std::tie(a.sort_key, a.first_vertex, a.vertex_count, a.first_instance, a.instance_count)
+			< std::tie(b.sort_key, b.first_vertex, b.vertex_count, b.first_instance, b.instance_count);
+	});
+}
+
+auto hash_draw_commands(std::span<const DrawCommand> commands) -> u64 {
+	static_assert(sizeof(DrawCommand) == sizeof(u64) + 4u * sizeof(u32), "draw commands must not contain padding");
+	auto bytes = std::string_view(reinterpret_cast<const char*>(commands.data()), commands.size_bytes());
+	return std::hash<std::string_view>{}(bytes);
+}
+
+DrawCache::DrawCache(vk::Device dev, u32 qu_fam_idx, usz frames_in_flight)
+	: dev{dev}, frames_in_flight{frames_in_flight} {
+	this->pool = dev.createCommandPoolUnique(vk::CommandPoolCreateInfo{}
+		.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+		.setQueueFamilyIndex(qu_fam_idx)
+	);
+}
+
+void DrawCache::begin_frame(vk::Format fmt, u64 frame) {
+	this->frame = frame;
+	this->miss_count = 0u;
+
+	for (usz i = 0u; i < this->retired.size();) {
+		if (frame >= this->retired[i].first + this->frames_in_flight) {
+			this->free.push_back(this->retired[i].second);
+			this->retired[i] = this->retired.back();
+			this->retired.pop_back();
+		} else {
+			i++;
+		}
+	}
+
+	if (fmt != this->fmt) {
+		this->fmt = fmt;
+		this->invalidate();
+	}
+
+	std::erase_if(this->cached, [&](const auto& entry) {
+		if (frame < entry.second.last_used + EVICT_AFTER) return false;
+		this->retired.emplace_back(entry.second.last_used, entry.second.cmd);
+		return true;
+	});
+}
+
+void DrawCache::invalidate() {
+	for (auto& [key, entry] : this->cached) {
+		this->retired.emplace_back(entry.last_used, entry.cmd);
+	}
+	this->cached.clear();
+}
+
+auto DrawCache::group(
+	std::span<const DrawCommand> commands,
+	vk::Extent2D extent,
+	const Recorder& record
+) -> vk::CommandBuffer {
+	// the viewport and scissor are recorded into the buffer
+	auto packed_extent = u64{extent.width} << 32u | extent.height;
+	auto key = hash_draw_commands(commands) ^ (packed_extent * 0x9e3779b97f4a7c15u);
+	auto found = this->cached.find(key);
+	if (found != this->cached.end()) {
+		auto& entry = found->second;
+		auto same = entry.extent == extent
+			&& entry.commands.size() == commands.size()
+			&& std::memcmp(entry.commands.data(), commands.data(), commands.size_bytes()) == 0;
+		if (same) {
+			entry.last_used = this->frame;
+			return entry.cmd;
+		}
+		// a hash collision, the other group records its buffer again when it comes back
+		this->retired.emplace_back(entry.last_used, entry.cmd);
+		this->cached.erase(found);
+	}
+
+	// the same buffer may be pending in several frames in flight at once
+	auto cmd = this->begin(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
+	record(cmd, commands);
+	cmd.end();
+	this->cached.emplace(key, Cached {
+		.cmd = cmd,
+		.last_used = this->frame,
+		.commands = std::vector<DrawCommand>(commands.begin(), commands.end()),
+		.extent = extent,
+	});
+	this->miss_count++;
+	return cmd;
+}
+
+auto DrawCache::transient(std::span<const DrawCommand> commands, const Recorder& record) -> vk::CommandBuffer {
+	auto cmd = this->begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	record(cmd, commands);
+	cmd.end();
+	this->retired.emplace_back(this->frame, cmd);
+	return cmd;
+}
+
+auto DrawCache::misses() const -> u32 {
+	return this->miss_count;
+}
+
+auto DrawCache::begin(vk::CommandBufferUsageFlags flags) -> vk::CommandBuffer {
+	auto cmd = vk::CommandBuffer{};
+	if (this->free.empty()) {
+		auto ainfo = vk::CommandBufferAllocateInfo{}
+			.setCommandPool(*this->pool)
+			.setCommandBufferCount(1u)
+			.setLevel(vk::CommandBufferLevel::eSecondary);
+		auto res = this->dev.allocateCommandBuffers(&ainfo, &cmd);
+		if (res != vk::Result::eSuccess) {
+			throw std::runtime_error("failed to allocate secondary command buffer");
+		}
+	} else {
+		cmd = this->free.back();
+		this->free.pop_back();
+	}
+
+	auto rendering = vk::CommandBufferInheritanceRenderingInfo{}
+		.setColorAttachmentFormats(this->fmt)
+		.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+	auto inheritance = vk::CommandBufferInheritanceInfo{}.setPNext(&rendering);
+	cmd.begin(vk::CommandBufferBeginInfo{}
+		.setFlags(flags | vk::CommandBufferUsageFlagBits::eRenderPassContinue)
+		.setPInheritanceInfo(&inheritance)
+	);
+	return cmd;
+}
@@ -0,0 +1,136 @@
+#ifdef VK_SHADER_HOT_RELOAD
+
+#include "hot_reload.hpp"
+
+#include <array>
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "shader.hpp"
+#include "sugar.hpp"
+
+// editors tend to write a file in several steps, so wait this long for more events before compiling
+constexpr i32 DEBOUNCE_MS = 50;
+constexpr i32 POLL_MS = 100;
+
+ShaderWatcher::ShaderWatcher(
+	std::filesystem::path src_dir,
+	std::string slangc,
+	Builder build
+) : src_dir{std::move(src_dir)}, slangc{std::move(slangc)}, build{std::move(build)} {
+	this->out_dir = std::filesystem::temp_directory_path() / "vk_shaders";
+	std::filesystem::create_directories(this->out_dir);
+
+	this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (this->inotify_fd < 0) {
+		throw std::runtime_error("failed to initialize inotify");
+	}
+	if (inotify_add_watch(this->inotify_fd, this->src_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(this->inotify_fd);
+		throw std::runtime_error("failed to watch shader directory");
+	}
+
+	std::cout << "watching shaders in " << this->src_dir << std::endl;
+	this->thread = std::thread(&ShaderWatcher::run, this);
+}
+
+ShaderWatcher::~ShaderWatcher() {
+	this->running.store(false);
+	if (this->thread.joinable()) {
+		this->thread.join();
+	}
+	this->ready.consume_all([](ReloadedPipeline* ptr) { delete ptr; });
+	close(this->inotify_fd);
+}
+
+auto ShaderWatcher::poll() -> std::unique_ptr<ReloadedPipeline> {
+	ReloadedPipeline* ptr = nullptr;
+	this->ready.pop(ptr);
+	return std::unique_ptr<ReloadedPipeline>(ptr);
+}
+
+void ShaderWatcher::run() {
+	alignas(inotify_event) std::array<char, 4096> buf;
+	auto pfd = pollfd{ .fd = this->inotify_fd, .events = POLLIN, .revents = 0 };
+
+	while (this->running) {
+		if (::poll(&pfd, 1, POLL_MS) <= 0) continue;
+
+		auto changed = std::set<std::string>{};
+		do {
+			isz len;
+			while ((len = read(this->inotify_fd, buf.data(), buf.size())) > 0) {
+				for (isz ofs = 0; ofs < len;) {
+					auto ev = reinterpret_cast<const inotify_event*>(buf.data() + ofs);
+					if (ev->len > 0) {
+						auto name = std::string(ev->name);
+						if (name.ends_with(".slang")) {
+							changed.insert(name);
+						}
+					}
+					ofs += static_cast<isz>(sizeof(inotify_event) + ev->len);
+				}
+			}
+		} while (::poll(&pfd, 1, DEBOUNCE_MS) > 0);
+
+		for (auto& name : changed) {
+			auto src = this->src_dir / name;
+			auto code = this->compile(src);
+			if (!code.has_value()) continue;
+
+			auto shader = src.stem().string();
+			auto pipeline = vk::UniquePipeline{};
+			try {
+				auto words = std::span<const u32>(reinterpret_cast<const u32*>(code->data()), code->size() / sizeof(u32));
+				pipeline = this->build(shader, words);
+			} catch (std::exception& e) {
+				std::cerr << "failed to rebuild pipeline for " << shader << ": " << e.what() << std::endl;
+				continue;
+			}
+			if (!pipeline) {
+				std::cerr << shader << " cannot be hot reloaded, restart to pick up the change" << std::endl;
+				continue;
+			}
+
+			auto ptr = new ReloadedPipeline{ .shader = shader, .pipeline = std::move(pipeline) };
+			if (!this->ready.push(ptr)) {
+				// render thread is not draining, drop this build, the next save will retry
+				delete ptr;
+				continue;
+			}
+			std::cout << "reloaded shader " << shader << std::endl;
+		}
+	}
+}
+
+auto ShaderWatcher::compile(const std::filesystem::path& src) -> std::optional<std::vector<char>> {
+	auto out = this->out_dir / (src.stem().string() + ".spv");
+	// same flags as target_slang_shaders in CMakeLists.txt
+	auto cmd = this->slangc + " \"" + src.string() + "\" -target spirv -o \"" + out.string() + "\" 2>&1";
+
+	auto pipe = popen(cmd.c_str(), "r");
+	if (pipe == nullptr) {
+		std::cerr << "failed to run " << this->slangc << std::endl;
+		return {};
+	}
+	auto log = std::string{};
+	auto chunk = std::array<char, 256>{};
+	while (fgets(chunk.data(), chunk.size(), pipe) != nullptr) {
+		log += chunk.data();
+	}
+	auto status = pclose(pipe);
+
+	if (status != 0) {
+		std::cerr << "failed to compile " << src.filename() << ":\n" << log << std::endl;
+		return {};
+	}
+	return read_file(out.string());
+}
+
+#endif
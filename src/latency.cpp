@@ -0,0 +1,253 @@
+#include "latency.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+#include "shaders/latency_overlay.hpp"
+
+static_assert(shaders::latency_overlay.binding("quads").set == 0u);
+
+// graph geometry in pixels
+static constexpr flt MARGIN = 16.0f;
+static constexpr flt BAR_WIDTH = 3.0f;
+static constexpr flt PX_PER_MS = 3.0f;
+static constexpr flt GRAPH_MS = 50.0f;
+static constexpr flt GRID_MS = 10.0f;
+static constexpr u32 GRID_LINES = 4u;
+
+// one per span between consecutive stages, input to push first
+static constexpr auto SPAN_COLORS = std::array{
+	glm::vec4(0.85f, 0.35f, 0.85f, 0.9f),
+	glm::vec4(0.95f, 0.75f, 0.2f, 0.9f),
+	glm::vec4(0.3f, 0.75f, 0.95f, 0.9f),
+	glm::vec4(0.35f, 0.9f, 0.4f, 0.9f),
+};
+static_assert(SPAN_COLORS.size() == LATENCY_STAGE_COUNT - 1u);
+static constexpr u32 MAX_QUADS = 1u + LatencyOverlay::FRAMES * SPAN_COLORS.size() + GRID_LINES;
+
+auto steady_ns() -> u64 {
+	return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count());
+}
+
+auto FrameTimestamps::at(LatencyStage stage) const -> u64 {
+	switch (stage) {
+		case LatencyStage::Input: return this->input_ns;
+		case LatencyStage::Push: return this->push_ns;
+		case LatencyStage::Pop: return this->pop_ns;
+		case LatencyStage::Submit: return this->submit_ns;
+		case LatencyStage::Present: return this->present_ns;
+	}
+	return 0u;
+}
+
+LatencyTracker::LatencyTracker(usz window) : frames(std::max(window, usz{1u})) {
+	this->scratch.reserve(this->frames.size());
+}
+
+void LatencyTracker::record(const FrameTimestamps& frame) {
+	this->frames[this->next] = frame;
+	this->next = (this->next + 1u) % this->frames.size();
+	this->count = std::min(this->count + 1u, this->frames.size());
+}
+
+auto LatencyTracker::percentiles(LatencyStage from, LatencyStage to) const -> LatencyPercentiles {
+	this->scratch.clear();
+	for (usz age = 0u; age < this->count; age++) {
+		auto& frame = this->recent(age);
+		auto start = frame.at(from);
+		auto end = frame.at(to);
+		if (start != 0u && end >= start) {
+			this->scratch.push_back(end - start);
+		}
+	}
+	if (this->scratch.empty()) {
+		return {};
+	}
+
+	// nearest rank
+	std::sort(this->scratch.begin(), this->scratch.end());
+	auto rank = [&](flt p) {
+		auto idx = static_cast<usz>(std::ceil(p * static_cast<flt>(this->scratch.size()))) - 1u;
+		return static_cast<flt>(this->scratch[std::min(idx, this->scratch.size() - 1u)]) / 1e6f;
+	};
+	return LatencyPercentiles {
+		.p50_ms = rank(0.5f),
+		.p90_ms = rank(0.9f),
+		.p99_ms = rank(0.99f),
+		.max_ms = static_cast<flt>(this->scratch.back()) / 1e6f,
+		.samples = this->scratch.size(),
+	};
+}
+
+auto LatencyTracker::size() const -> usz {
+	return this->count;
+}
+
+auto LatencyTracker::recent(usz age) const -> const FrameTimestamps& {
+	auto n = this->frames.size();
+	return this->frames[(this->next + n - 1u - age % n) % n];
+}
+
+LatencyOverlay::LatencyOverlay(
+	vk::Device dev,
+	VulkanAllocator* alloc,
+	vk::Format color_fmt,
+	usz frames_in_flight
+) : dev{dev}, alloc{alloc} {
+	for (usz i = 0u; i < frames_in_flight; i++) {
+		this->quads.push_back(alloc->create_dynamic_buffer(
+			MAX_QUADS * sizeof(OverlayQuad),
+			vk::BufferUsageFlagBits::eStorageBuffer
+		));
+	}
+
+	this->layout = create_shader_layout(dev, shaders::latency_overlay);
+	this->pipeline = this->build_pipeline(color_fmt);
+
+	auto sets = cast<u32>(frames_in_flight);
+	auto pool_size = vk::DescriptorPoolSize{}
+		.setType(vk::DescriptorType::eStorageBuffer)
+		.setDescriptorCount(sets);
+	this->descriptor_pool = dev.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{}
+		.setMaxSets(sets)
+		.setPoolSizes(pool_size)
+	);
+	auto layouts = std::vector<vk::DescriptorSetLayout>(frames_in_flight, *this->layout.set_layouts.at(0));
+	this->sets = dev.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{}
+		.setDescriptorPool(*this->descriptor_pool)
+		.setSetLayouts(layouts)
+	);
+
+	// the buffers are never moved, so the sets are written once
+	for (usz i = 0u; i < frames_in_flight; i++) {
+		auto info = vk::DescriptorBufferInfo{this->quads[i].gpu->buf, 0u, vk::WholeSize};
+		auto binding = shaders::latency_overlay.binding("quads");
+		auto write = vk::WriteDescriptorSet{}
+			.setDstSet(this->sets[i])
+			.setDstBinding(binding.binding)
+			.setDescriptorType(binding.type)
+			.setBufferInfo(info);
+		dev.updateDescriptorSets(write, {});
+	}
+}
+
+// the owner waits for the device to be idle first
+LatencyOverlay::~LatencyOverlay() {
+	for (auto& buf : this->quads) {
+		this->alloc->destroy_dynamic_buffer(buf);
+	}
+}
+
+void LatencyOverlay::update(vk::CommandBuffer cmd, usz sync_idx, const LatencyTracker& tracker) {
+	auto& buf = this->quads[sync_idx];
+	auto out = static_cast<OverlayQuad*>(buf.mapped);
+	u32 n = 0u;
+
+	auto height = GRAPH_MS * PX_PER_MS;
+	auto width = static_cast<flt>(FRAMES) * BAR_WIDTH;
+	out[n++] = OverlayQuad{ .pos = {MARGIN, MARGIN}, .size = {width, height}, .color = {0.0f, 0.0f, 0.0f, 0.6f} };
+
+	// newest on the right, each span stacked on the one before it
+	auto frames = std::min(tracker.size(), usz{FRAMES});
+	for (usz age = 0u; age < frames; age++) {
+		auto& frame = tracker.recent(age);
+		auto x = MARGIN + width - static_cast<flt>(age + 1u) * BAR_WIDTH;
+		auto y = 0.0f;
+		for (usz span = 0u; span < SPAN_COLORS.size(); span++) {
+			auto start = frame.at(static_cast<LatencyStage>(span));
+			auto end = frame.at(static_cast<LatencyStage>(span + 1u));
+			if (start == 0u || end < start) continue;
+			auto h = std::min(static_cast<flt>(end - start) / 1e6f * PX_PER_MS, height - y);
+			if (h <= 0.0f) continue;
+			out[n++] = OverlayQuad{ .pos = {x, MARGIN + y}, .size = {BAR_WIDTH - 1.0f, h}, .color = SPAN_COLORS[span] };
+			y += h;
+		}
+	}
+
+	for (u32 line = 1u; line <= GRID_LINES; line++) {
+		auto y = MARGIN + static_cast<flt>(line) * GRID_MS * PX_PER_MS;
+		out[n++] = OverlayQuad{ .pos = {MARGIN, y}, .size = {width, 1.0f}, .color = {1.0f, 1.0f, 1.0f, 0.35f} };
+	}
+
+	this->alloc->upload_dynamic(cmd, buf, n * sizeof(OverlayQuad),
+		vk::PipelineStageFlagBits2::eVertexShader, vk::AccessFlagBits2::eShaderStorageRead
+	);
+	this->quad_count = n;
+	this->sync_idx = sync_idx;
+}
+
+void LatencyOverlay::draw(vk::CommandBuffer cmd, vk::Extent2D extent) const {
+	auto layout = *this->layout.pipeline_layout;
+	cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *this->pipeline);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0u, this->sets[this->sync_idx], {});
+
+	auto target = glm::vec2(static_cast<flt>(extent.width), static_cast<flt>(extent.height));
+	cmd.setViewport(0, vk::Viewport{0.0f, 0.0f, target.x, target.y, 0.0f, 1.0f});
+	cmd.setScissor(0, vk::Rect2D{{0, 0}, extent});
+	cmd.pushConstants(layout, shaders::latency_overlay.stages, 0u, sizeof(target), &target);
+	cmd.draw(6u * this->quad_count, 1u, 0u, 0u);
+}
+
+auto LatencyOverlay::build_pipeline(vk::Format color_fmt) const -> vk::UniquePipeline {
+	auto module = this->dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo{}
+		.setCodeSize(shaders::latency_overlay.spirv.size() * sizeof(u32))
+		.setPCode(shaders::latency_overlay.spirv.data())
+	);
+
+	constexpr auto vert_main = shaders::latency_overlay.entry_point(vk::ShaderStageFlagBits::eVertex);
+	constexpr auto frag_main = shaders::latency_overlay.entry_point(vk::ShaderStageFlagBits::eFragment);
+	auto shader_stages = std::array{
+		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *module, vert_main),
+		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *module, frag_main),
+	};
+
+	// quads are expanded from the vertex index in the vertex shader
+	auto vertex_input = vk::PipelineVertexInputStateCreateInfo{};
+	auto input_assembly = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList);
+	auto viewport_state = vk::PipelineViewportStateCreateInfo({}, 1, nullptr, 1, nullptr);
+	auto rasterizer = vk::PipelineRasterizationStateCreateInfo{}
+		.setPolygonMode(vk::PolygonMode::eFill)
+		.setCullMode(vk::CullModeFlagBits::eNone)
+		.setLineWidth(1.0f);
+	auto multisample = vk::PipelineMultisampleStateCreateInfo{}.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+
+	auto color_blend_attachment = vk::PipelineColorBlendAttachmentState{}
+		.setBlendEnable(true)
+		.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+		.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+		.setColorBlendOp(vk::BlendOp::eAdd)
+		.setSrcAlphaBlendFactor(vk::BlendFactor::eZero)
+		.setDstAlphaBlendFactor(vk::BlendFactor::eOne)
+		.setAlphaBlendOp(vk::BlendOp::eAdd)
+		.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+	auto color_blend = vk::PipelineColorBlendStateCreateInfo{}.setAttachments(color_blend_attachment);
+
+	auto dynamic_states = std::array{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+	auto dynamic_info = vk::PipelineDynamicStateCreateInfo{}.setDynamicStates(dynamic_states);
+
+	auto pipeline_rendering_info = vk::PipelineRenderingCreateInfo{}
+		.setColorAttachmentFormats(color_fmt);
+
+	auto pipeline_info = vk::GraphicsPipelineCreateInfo{}
+		.setPNext(&pipeline_rendering_info)
+		.setStages(shader_stages)
+		.setPVertexInputState(&vertex_input)
+		.setPInputAssemblyState(&input_assembly)
+		.setPViewportState(&viewport_state)
+		.setPRasterizationState(&rasterizer)
+		.setPMultisampleState(&multisample)
+		.setPColorBlendState(&color_blend)
+		.setPDynamicState(&dynamic_info)
+		.setLayout(*this->layout.pipeline_layout);
+
+	auto result = this->dev.createGraphicsPipelineUnique(nullptr, pipeline_info);
+	if (result.result != vk::Result::eSuccess) {
+		throw std::runtime_error("Failed to create latency overlay pipeline");
+	}
+	return std::move(result.value);
+}
@@ -1,17 +1,34 @@
+#include <algorithm>
+#include <cctype>
 #include <chrono>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <span>
 #include <thread>
+#include <vector>
 
 #include <boost/lockfree/spsc_queue.hpp>
 #include <SDL.h>
 #include <SDL_video.h>
 #include <SDL_vulkan.h>
 
+#include "alloc_count.hpp"
+#include "arena.hpp"
+#include "capture.hpp"
+#include "latency.hpp"
+#include "meshlet.hpp"
 #include "renderer.hpp"
 #include "sugar.hpp"
 
-boost::lockfree::spsc_queue<FrameContext*, boost::lockfree::capacity<4>> render_queue;
-boost::lockfree::spsc_queue<FrameContext*, boost::lockfree::capacity<4>> free_queue;
+// frames to settle in before checking for heap allocations (see VK_COUNT_ALLOCS),
+// restarted whenever a resize or a render scale change rebuilds resources
+constexpr u64 ALLOC_WARMUP_FRAMES = 120u;
+constexpr u64 LATENCY_REPORT_NS = 1'000'000'000u;
+
+FrameQueue render_queue;
+FrameQueue free_queue;
 
 std::atomic<bool> is_running{true};
 
@@ -20,20 +37,88 @@ void delete_all(boost::lockfree::spsc_queue<T*, Options...>& queue) {
 	queue.consume_all([](T* ptr) { delete ptr; });
 }
 
-void render_loop(Window* win) {
-	auto renderer = Renderer(win);
+// keyboard, mouse, joystick, controller and touch events all fall between these
+static auto is_input_event(u32 type) -> bool {
+	return type >= SDL_KEYDOWN && type < SDL_CLIPBOARDUPDATE;
+}
+
+// SDL stamps events in milliseconds since it was initialized, this moves that onto steady_ns()
+static auto event_ns(const SDL_Event& ev) -> u64 {
+	auto age_ms = SDL_GetTicks() - ev.common.timestamp;
+	return steady_ns() - u64{age_ms} * 1'000'000u;
+}
+
+static void print_latency(const LatencyTracker& latency) {
+	auto print = [&](const char* name, LatencyStage from, LatencyStage to) {
+		auto p = latency.percentiles(from, to);
+		if (p.samples == 0u) return;
+		std::cout << name << " p50 " << p.p50_ms << " p90 " << p.p90_ms << " p99 " << p.p99_ms
+			<< " max " << p.max_ms << " ms (" << p.samples << " frames)" << std::endl;
+	};
+	print("input to present:", LatencyStage::Input, LatencyStage::Present);
+	print("push to present: ", LatencyStage::Push, LatencyStage::Present);
+	print("pop to submit:   ", LatencyStage::Pop, LatencyStage::Submit);
+}
+
+void render_loop(
+	std::span<Window* const> wins,
+	std::optional<flt> target_ms,
+	bool particles,
+	const MeshletMesh* meshlets,
+	bool latency
+) {
+	auto renderer = Renderer(wins);
+	renderer.set_target_frame_time(target_ms);
+	if (particles) {
+		renderer.enable_particles();
+	}
+	if (meshlets != nullptr) {
+		renderer.enable_meshlets(*meshlets);
+	}
+	renderer.show_latency_overlay(latency);
+	auto last_report_ns = steady_ns();
+
+	u64 settled_frames = 0u;
+	auto settled_szs = std::vector<glm::ivec2>(wins.size());
+	auto settled_scale = renderer.render_scale();
 
 	while (is_running) {
 		FrameContext* ctx = nullptr;
 		if (render_queue.pop(ctx)) {
-			renderer.draw(ctx->pkt);
+			auto pop_ns = steady_ns();
+			for (auto pkt : ctx->pkts) {
+				pkt->stamps.pop_ns = pop_ns;
+			}
+			auto allocs = thread_heap_allocs();
+			renderer.draw(ctx->pkts);
+
+			if (renderer.render_scale() != settled_scale) {
+				settled_frames = 0u;
+				settled_scale = renderer.render_scale();
+			}
+			for (usz i = 0u; i < ctx->pkts.size(); i++) {
+				if (ctx->pkts[i]->drawable_sz != settled_szs[i]) {
+					settled_frames = 0u;
+					settled_szs[i] = ctx->pkts[i]->drawable_sz;
+				}
+			}
+			if (settled_frames++ >= ALLOC_WARMUP_FRAMES) {
+				expect_no_heap_allocs(allocs, "Renderer::draw");
+			}
 
 			// send arena back to main
 			while (!free_queue.push(ctx)) {
 				// spin if main thread is lagging behind (unlikely)
 				std::this_thread::yield();
 			}
+
+			if (latency && steady_ns() - last_report_ns >= LATENCY_REPORT_NS) {
+				print_latency(renderer.latency());
+				last_report_ns = steady_ns();
+			}
 		} else {
+			// presents that reach the screen now are timed within a yield
+			renderer.poll_presents();
 			std::this_thread::yield();
 		}
 	}
@@ -41,26 +126,104 @@ void render_loop(Window* win) {
 	delete_all(render_queue);
 }
 
-int main() {
-	auto win = Window();
+int main(int argc, char** argv) {
+	// --capture <file> records every frame packet for vk_replay
+	// --target-ms <ms> lowers the render resolution to hold a GPU frame time
+	// --particles runs the GPU particle system
+	// --windows <n> opens n windows, one per display while there are enough,
+	//   the capture only records the first one
+	// --meshlets <segments|file> draws a meshlet container, or a generated torus
+	//   with 2 * segments * segments / 2 triangles
+	// --save-meshlets <file> writes the meshlets built for --meshlets
+	// --latency shows a graph of the last frames' latency and prints percentiles every second
+	auto recorder = std::unique_ptr<PacketRecorder>{};
+	auto target_ms = std::optional<flt>{};
+	auto particles = false;
+	u32 window_count = 1u;
+	auto meshlet_src = std::optional<std::string>{};
+	auto meshlet_out = std::optional<std::string>{};
+	auto latency = false;
+	for (int i = 1; i < argc; i++) {
+		auto arg = std::string(argv[i]);
+		if (arg == "--capture" && i + 1 < argc) {
+			recorder = std::make_unique<PacketRecorder>(argv[++i]);
+		} else if (arg == "--target-ms" && i + 1 < argc) {
+			target_ms = std::stof(argv[++i]);
+		} else if (arg == "--particles") {
+			particles = true;
+		} else if (arg == "--windows" && i + 1 < argc) {
+			window_count = cast<u32>(std::max(std::stoi(argv[++i]), 1));
+		} else if (arg == "--meshlets" && i + 1 < argc) {
+			meshlet_src = argv[++i];
+		} else if (arg == "--save-meshlets" && i + 1 < argc) {
+			meshlet_out = argv[++i];
+		} else if (arg == "--latency") {
+			latency = true;
+		} else {
+			std::cerr << "usage: vk [--capture <file>] [--target-ms <ms>] [--particles] [--windows <n>]"
+				<< " [--meshlets <segments|file>] [--save-meshlets <file>] [--latency]" << std::endl;
+			return 2;
+		}
+	}
+
+	auto meshlets = std::optional<MeshletMesh>{};
+	if (meshlet_src.has_value()) {
+		auto& src = meshlet_src.value();
+		if (std::all_of(src.begin(), src.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+			meshlets = build_meshlet_mesh(make_torus_mesh(cast<u32>(std::stoul(src))));
+		} else {
+			meshlets = read_meshlet_container(src);
+		}
+		std::cout << meshlets->triangles << " triangles in " << meshlets->meshlets.size()
+			<< " meshlets over " << meshlets->lod_levels << " levels" << std::endl;
+		if (meshlet_out.has_value()) {
+			write_meshlet_container(meshlet_out.value(), meshlets.value());
+		}
+	}
+
+	auto windows = std::vector<std::unique_ptr<Window>>{};
+	auto wins = std::vector<Window*>{};
+	auto drawable_szs = std::vector<glm::ivec2>{};
+	for (u32 i = 0u; i < window_count; i++) {
+		windows.push_back(std::make_unique<Window>(i));
+		wins.push_back(windows.back().get());
+		drawable_szs.push_back(windows.back()->sz);
+	}
 
-	auto render_thread = std::thread(render_loop, &win);
+	auto render_thread = std::thread(
+		render_loop,
+		std::span<Window* const>(wins),
+		target_ms,
+		particles,
+		meshlets.has_value() ? &meshlets.value() : nullptr,
+		latency
+	);
 	for (usz i = 0; i < 3; i++) {
 		free_queue.push(new FrameContext());
 	}
 
 	SDL_Event ev;
+	u64 frame_idx = 0u;
+	u64 input_ns = 0u; // oldest input not yet in a packet
 	auto t_prev = std::chrono::steady_clock::now();
-	auto drawable_sz = win.sz;
 
 	while (true) {
 		while (SDL_PollEvent(&ev)) {
+			if (input_ns == 0u && is_input_event(ev.type)) {
+				input_ns = event_ns(ev);
+			}
 			switch (ev.type) {
 				case SDL_QUIT: goto quit;
 				case SDL_WINDOWEVENT:
-					switch (ev.window.type) {
+					switch (ev.window.event) {
+						// the swapchains are fixed, so closing any window quits
+						case SDL_WINDOWEVENT_CLOSE: goto quit;
 						case SDL_WINDOWEVENT_RESIZED:
-							SDL_Vulkan_GetDrawableSize(win.inner, &drawable_sz.x, &drawable_sz.y);
+							for (usz i = 0u; i < wins.size(); i++) {
+								if (SDL_GetWindowID(wins[i]->inner) == ev.window.windowID) {
+									SDL_Vulkan_GetDrawableSize(wins[i]->inner, &drawable_szs[i].x, &drawable_szs[i].y);
+								}
+							}
 							break;
 						default: break;
 					}
@@ -79,15 +242,41 @@ int main() {
 			// this should probably continue simulating, but for now we just skip
 			continue;
 		}
+		auto allocs = thread_heap_allocs();
 		ctx->arena.reset();
 
-		ctx->pkt = ctx->arena.alloc<FramePacket>();
-		ctx->pkt->t = t_now.time_since_epoch().count();
-		ctx->pkt->dt = dt.count();
-		ctx->pkt->drawable_sz = drawable_sz;
-		// TODO: draw commands
+		ctx->pkts = ctx->arena.alloc_array<FramePacket*>(wins.size());
+		for (usz i = 0u; i < wins.size(); i++) {
+			auto pkt = ctx->arena.alloc<FramePacket>();
+			pkt->t = t_now.time_since_epoch().count();
+			pkt->dt = dt.count();
+			pkt->drawable_sz = drawable_szs[i];
+			pkt->stamps.input_ns = input_ns;
+
+			auto commands = ArenaVector<DrawCommand>(ctx->arena);
+			commands.push_back(DrawCommand {
+				.sort_key = 0u,
+				.vertex_count = 3u,
+				.instance_count = 1u,
+				.first_vertex = 0u,
+				.first_instance = 0u,
+			});
+			pkt->commands = commands.span();
+			ctx->pkts[i] = pkt;
+		}
 
+		if (recorder) {
+			recorder->write(*ctx->pkts.front());
+		}
+		if (frame_idx++ >= ALLOC_WARMUP_FRAMES) {
+			expect_no_heap_allocs(allocs, "building the frame packet");
+		}
+		auto push_ns = steady_ns();
+		for (auto pkt : ctx->pkts) {
+			pkt->stamps.push_ns = push_ns;
+		}
 		render_queue.push(ctx);
+		input_ns = 0u;
 	}
 
 quit:
@@ -97,6 +286,10 @@ quit:
 	}
 	delete_all(free_queue);
 
+	if (recorder) {
+		std::cout << "captured " << recorder->frames() << " frames" << std::endl;
+	}
+
 	std::cout << "Exiting" << std::endl;
 
 }
@@ -0,0 +1,1064 @@
+#include "meshlet.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cstddef>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numbers>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include <glm/common.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/vector_int3.hpp>
+#include <glm/geometric.hpp>
+
+#include "shaders/meshlet_cull.hpp"
+#include "shaders/meshlet_draw.hpp"
+
+// numthreads of cull in meshlet_cull.slang
+static constexpr u32 CULL_GROUP_SIZE = 64u;
+// meshlets simplified together, more means fewer locked borders but coarser steps
+static constexpr usz LOD_GROUP_SIZE = 8u;
+// meshlets further along the z-curve considered for a group
+static constexpr usz LOD_GROUP_WINDOW = 64u;
+// a group has to lose at least this much to be worth another level
+static constexpr flt MIN_REDUCTION = 0.85f;
+static constexpr u32 MAX_LOD_PASSES = 32u;
+// doublings of the grid cell tried on a group before leaving it for the next level
+static constexpr u32 MAX_CELL_GROWTH = 3u;
+static constexpr u32 NO_VERTEX = ~0u;
+
+constexpr auto MAGIC = std::array{'V', 'K', 'M', 'L'};
+constexpr u32 VERSION = 1u;
+
+struct MeshletHeader {
+	std::array<char, 4> magic; // "VKML"
+	u32 version;
+	u32 vertex_count;
+	u32 meshlet_vertex_count;
+	u32 triangle_bytes;
+	u32 meshlet_count;
+	u32 lod_levels;
+	u32 pad;
+	u64 triangles;
+	glm::vec3 center;
+	flt radius;
+};
+
+static_assert(shaders::meshlet_cull.binding("meshlets").set == 0u);
+static_assert(shaders::meshlet_cull.binding("visible").set == 0u);
+static_assert(shaders::meshlet_cull.binding("drawArgs").set == 0u);
+static_assert(shaders::meshlet_draw.binding("vertices").set == 0u);
+static_assert(shaders::meshlet_draw.binding("meshletVertices").set == 0u);
+static_assert(shaders::meshlet_draw.binding("meshletTriangles").set == 0u);
+static_assert(shaders::meshlet_draw.binding("meshlets").set == 0u);
+static_assert(shaders::meshlet_draw.binding("visible").set == 0u);
+static_assert(shaders::meshlet_cull.stages == vk::ShaderStageFlagBits::eCompute);
+
+struct Sphere {
+	glm::vec3 center;
+	flt radius;
+};
+
+// a meshlet of the level being built, with its triangles as mesh vertex indices
+struct Cluster {
+	u32 meshlet;
+	std::vector<u32> indices;
+	flt cell; // grid cell the next simplification of its group starts with
+};
+
+static auto spread_bits(u32 v) -> u32 {
+	v &= 0x3ffu;
+	v = (v | v << 16u) & 0x030000ffu;
+	v = (v | v << 8u) & 0x0300f00fu;
+	v = (v | v << 4u) & 0x030c30c3u;
+	v = (v | v << 2u) & 0x09249249u;
+	return v;
+}
+
+// 10 bits per axis within the box
+static auto morton(glm::vec3 p, glm::vec3 lo, glm::vec3 hi) -> u32 {
+	auto q = glm::clamp((p - lo) / glm::max(hi - lo, glm::vec3(FLT_MIN)), 0.0f, 1.0f) * 1023.0f;
+	return spread_bits(static_cast<u32>(q.x))
+		| spread_bits(static_cast<u32>(q.y)) << 1u
+		| spread_bits(static_cast<u32>(q.z)) << 2u;
+}
+
+// order that walks the points along a z-curve, so neighbours stay close
+static auto morton_order(std::span<const glm::vec3> points) -> std::vector<u32> {
+	auto lo = glm::vec3(FLT_MAX);
+	auto hi = glm::vec3(-FLT_MAX);
+	for (auto& p : points) {
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	auto keyed = std::vector<std::pair<u32, u32>>(points.size());
+	for (usz i = 0u; i < points.size(); i++) {
+		keyed[i] = {morton(points[i], lo, hi), cast<u32>(i)};
+	}
+	std::sort(keyed.begin(), keyed.end());
+
+	auto order = std::vector<u32>(points.size());
+	std::transform(keyed.begin(), keyed.end(), order.begin(), [](const auto& k) { return k.second; });
+	return order;
+}
+
+// Greedy grouping along the z-curve: a group starts at the first meshlet left
+// and takes the nearby ones sharing the most vertices with it, counting those on
+// the last level's borders more so the new borders cut through the old groups
+// instead of locking the same vertices again.
+static auto group_clusters(
+	const std::vector<Cluster>& level,
+	const std::vector<Meshlet>& meshlets,
+	const std::vector<u8>& was_locked,
+	std::vector<u32>& stamp
+) -> std::vector<std::vector<u32>> {
+	auto centers = std::vector<glm::vec3>(level.size());
+	for (usz i = 0u; i < level.size(); i++) {
+		centers[i] = meshlets[level[i].meshlet].center;
+	}
+	auto order = morton_order(centers);
+
+	std::fill(stamp.begin(), stamp.end(), NO_VERTEX);
+	auto grouped = std::vector<u8>(level.size(), 0u);
+	auto groups = std::vector<std::vector<u32>>{};
+	for (usz first = 0u; first < order.size(); first++) {
+		if (grouped[order[first]]) continue;
+
+		auto id = cast<u32>(groups.size());
+		auto& group = groups.emplace_back();
+		auto take = [&](u32 c) {
+			grouped[c] = 1u;
+			group.push_back(c);
+			for (auto v : level[c].indices) {
+				stamp[v] = id;
+			}
+		};
+		take(order[first]);
+
+		while (group.size() < LOD_GROUP_SIZE) {
+			auto best = NO_VERTEX;
+			auto best_score = 0u;
+			for (usz i = first + 1u, seen = 0u; i < order.size() && seen < LOD_GROUP_WINDOW; i++) {
+				auto c = order[i];
+				if (grouped[c]) continue;
+				seen++;
+				auto score = 0u;
+				for (auto v : level[c].indices) {
+					if (stamp[v] == id) score += was_locked[v] ? 4u : 1u;
+				}
+				if (best == NO_VERTEX || score > best_score) {
+					best = c;
+					best_score = score;
+				}
+			}
+			if (best == NO_VERTEX) break;
+			take(best);
+		}
+	}
+	return groups;
+}
+
+static void sort_triangles(std::span<const glm::vec3> positions, std::vector<u32>& indices) {
+	auto centroids = std::vector<glm::vec3>(indices.size() / 3u);
+	for (usz t = 0u; t < centroids.size(); t++) {
+		centroids[t] = (positions[indices[3u * t]] + positions[indices[3u * t + 1u]] + positions[indices[3u * t + 2u]]) / 3.0f;
+	}
+	auto sorted = std::vector<u32>{};
+	sorted.reserve(indices.size());
+	for (auto t : morton_order(centroids)) {
+		sorted.insert(sorted.end(), indices.begin() + 3u * t, indices.begin() + 3u * t + 3u);
+	}
+	indices = std::move(sorted);
+}
+
+// bounding sphere and normal cone, the cone as in meshoptimizer's meshopt_computeMeshletBounds
+static void compute_bounds(std::span<const glm::vec3> positions, std::span<const u32> tris, Meshlet& m) {
+	auto lo = glm::vec3(FLT_MAX);
+	auto hi = glm::vec3(-FLT_MAX);
+	for (auto v : tris) {
+		lo = glm::min(lo, positions[v]);
+		hi = glm::max(hi, positions[v]);
+	}
+	auto center = (lo + hi) * 0.5f;
+	auto radius = 0.0f;
+	for (auto v : tris) {
+		radius = std::max(radius, glm::distance(center, positions[v]));
+	}
+	m.center = center;
+	m.radius = radius;
+	m.cone_apex = center;
+	m.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+	m.cone_cutoff = 1.0f;
+
+	auto normals = std::array<std::pair<glm::vec3, u32>, MESHLET_MAX_TRIANGLES>{};
+	usz normal_count = 0u;
+	auto axis = glm::vec3(0.0f);
+	for (usz t = 0u; t < tris.size(); t += 3u) {
+		auto a = positions[tris[t]];
+		auto n = glm::cross(positions[tris[t + 1u]] - a, positions[tris[t + 2u]] - a);
+		auto len = glm::length(n);
+		if (len == 0.0f) continue;
+		normals[normal_count++] = {n / len, tris[t]};
+		axis += n / len;
+	}
+	if (normal_count == 0u || glm::length(axis) == 0.0f) return;
+	axis = glm::normalize(axis);
+
+	auto min_dp = 1.0f;
+	for (usz i = 0u; i < normal_count; i++) {
+		min_dp = std::min(min_dp, glm::dot(normals[i].first, axis));
+	}
+	// wider than about 84 degrees, it would hardly ever cull anything
+	if (min_dp <= 0.1f) return;
+
+	// move the apex back until every triangle's plane is in front of it
+	auto max_t = 0.0f;
+	for (usz i = 0u; i < normal_count; i++) {
+		auto& [n, corner] = normals[i];
+		max_t = std::max(max_t, glm::dot(center - positions[corner], n) / glm::dot(axis, n));
+	}
+	m.cone_apex = center - axis * max_t;
+	m.cone_axis = axis;
+	m.cone_cutoff = std::sqrt(1.0f - min_dp * min_dp);
+}
+
+// Splits the triangles into meshlets, all covered by the lod sphere or, at full
+// detail, by their own bounds. Meshlets grow greedily: each keeps adding the
+// free triangle touching it that brings the fewest new vertices, and a new one
+// starts next to the last, or at the first free triangle along the z-curve.
+// Compact meshlets have short borders, which is what later levels lock.
+static void emit_meshlets(
+	std::span<const glm::vec3> positions,
+	std::vector<u32> indices,
+	const std::optional<Sphere>& lod,
+	flt lod_error,
+	flt cell,
+	MeshletMesh& out,
+	std::vector<Cluster>& level,
+	std::vector<u32>& local,
+	std::vector<u32>& dense
+) {
+	sort_triangles(positions, indices);
+	auto tri_count = indices.size() / 3u;
+
+	// triangles around every vertex used here
+	auto used = std::vector<u32>{};
+	for (auto v : indices) {
+		if (dense[v] == NO_VERTEX) {
+			dense[v] = cast<u32>(used.size());
+			used.push_back(v);
+		}
+	}
+	auto first_tri = std::vector<u32>(used.size() + 1u, 0u);
+	for (auto v : indices) {
+		first_tri[dense[v] + 1u]++;
+	}
+	for (usz i = 1u; i < first_tri.size(); i++) {
+		first_tri[i] += first_tri[i - 1u];
+	}
+	auto adjacency = std::vector<u32>(indices.size());
+	auto cursor = first_tri;
+	for (usz i = 0u; i < indices.size(); i++) {
+		adjacency[cursor[dense[indices[i]]]++] = cast<u32>(i / 3u);
+	}
+
+	auto verts = std::vector<u32>{};
+	auto tris = std::vector<u32>{};
+	auto candidates = std::vector<u32>{}; // free triangles touching the meshlet, may repeat
+	auto emitted = std::vector<u8>(tri_count, 0u);
+	auto flush = [&] {
+		if (tris.empty()) return;
+		auto m = Meshlet{};
+		m.vertex_offset = cast<u32>(out.meshlet_vertices.size());
+		m.triangle_offset = cast<u32>(out.meshlet_triangles.size());
+		m.triangle_count = cast<u32>(tris.size() / 3u);
+		out.meshlet_vertices.insert(out.meshlet_vertices.end(), verts.begin(), verts.end());
+		for (auto v : tris) {
+			out.meshlet_triangles.push_back(cast<u8>(local[v]));
+		}
+		compute_bounds(positions, tris, m);
+
+		auto sphere = lod.value_or(Sphere{m.center, m.radius});
+		m.lod_center = sphere.center;
+		m.lod_radius = sphere.radius;
+		m.lod_error = lod_error;
+		m.parent_center = sphere.center;
+		m.parent_radius = sphere.radius;
+		m.parent_error = FLT_MAX;
+
+		level.push_back(Cluster{ .meshlet = cast<u32>(out.meshlets.size()), .indices = tris, .cell = cell });
+		out.meshlets.push_back(m);
+		for (auto v : verts) {
+			local[v] = NO_VERTEX;
+		}
+		verts.clear();
+		tris.clear();
+		candidates.clear();
+	};
+	auto new_verts = [&](u32 t) {
+		auto added = 0u;
+		for (usz k = 0u; k < 3u; k++) {
+			added += local[indices[3u * t + k]] == NO_VERTEX ? 1u : 0u;
+		}
+		return added;
+	};
+
+	auto seed = u32{0u};
+	for (usz done = 0u; done < tri_count; done++) {
+		auto best = NO_VERTEX;
+		auto best_added = 4u;
+		auto kept = usz{0u};
+		for (auto t : candidates) {
+			if (emitted[t]) continue;
+			candidates[kept++] = t;
+			auto added = new_verts(t);
+			if (added < best_added || (added == best_added && t < best)) {
+				best = t;
+				best_added = added;
+			}
+		}
+		candidates.resize(kept);
+		if (best == NO_VERTEX) {
+			while (emitted[seed]) seed++;
+			best = seed;
+			best_added = new_verts(best);
+		}
+		if (verts.size() + best_added > MESHLET_MAX_VERTICES || tris.size() == 3u * MESHLET_MAX_TRIANGLES) {
+			flush();
+		}
+
+		emitted[best] = 1u;
+		for (usz k = 0u; k < 3u; k++) {
+			auto v = indices[3u * best + k];
+			if (local[v] == NO_VERTEX) {
+				local[v] = cast<u32>(verts.size());
+				verts.push_back(v);
+				for (auto i = first_tri[dense[v]]; i < first_tri[dense[v] + 1u]; i++) {
+					if (!emitted[adjacency[i]]) candidates.push_back(adjacency[i]);
+				}
+			}
+			tris.push_back(v);
+		}
+	}
+	flush();
+
+	for (auto v : used) {
+		dense[v] = NO_VERTEX;
+	}
+}
+
+// Vertex clustering: unlocked vertices in the same grid cell collapse into one
+// of them, preferably a locked one, and locked vertices never move. Returns the
+// largest distance a vertex moved.
+static auto simplify(
+	std::span<const glm::vec3> positions,
+	std::span<const u32> indices,
+	const std::vector<u8>& locked,
+	flt cell,
+	std::vector<u32>& out
+) -> flt {
+	auto key = [&](u32 v) {
+		auto c = glm::ivec3(glm::floor(positions[v] / cell));
+		constexpr u64 mask = (u64{1u} << 21u) - 1u;
+		return (static_cast<u64>(c.x) & mask) << 42u | (static_cast<u64>(c.y) & mask) << 21u | (static_cast<u64>(c.z) & mask);
+	};
+
+	auto cells = std::unordered_map<u64, u32>{};
+	for (auto v : indices) {
+		if (locked[v]) cells.try_emplace(key(v), v);
+	}
+	auto remap = std::unordered_map<u32, u32>{};
+	auto error = 0.0f;
+	for (auto v : indices) {
+		if (locked[v] || remap.contains(v)) continue;
+		auto rep = cells.try_emplace(key(v), v).first->second;
+		remap.emplace(v, rep);
+		error = std::max(error, glm::distance(positions[v], positions[rep]));
+	}
+
+	auto mapped = [&](u32 v) { return locked[v] ? v : remap.at(v); };
+	for (usz t = 0u; t < indices.size(); t += 3u) {
+		auto a = mapped(indices[t]);
+		auto b = mapped(indices[t + 1u]);
+		auto c = mapped(indices[t + 2u]);
+		if (a == b || b == c || a == c) continue;
+		out.insert(out.end(), {a, b, c});
+	}
+	return error;
+}
+
+static auto pack_normal(glm::vec3 n) -> u32 {
+	auto q = glm::round((glm::normalize(n) * 0.5f + 0.5f) * 1023.0f);
+	return static_cast<u32>(q.x) | static_cast<u32>(q.y) << 10u | static_cast<u32>(q.z) << 20u;
+}
+
+auto build_meshlet_mesh(const Mesh& mesh) -> MeshletMesh {
+	auto positions = std::span<const glm::vec3>(mesh.positions);
+	auto out = MeshletMesh{};
+
+	auto indices = std::vector<u32>{};
+	indices.reserve(mesh.indices.size());
+	auto normals = std::vector<glm::vec3>(positions.size(), glm::vec3(0.0f));
+	auto edge_sum = 0.0;
+	for (usz t = 0u; t + 2u < mesh.indices.size(); t += 3u) {
+		auto a = mesh.indices[t];
+		auto b = mesh.indices[t + 1u];
+		auto c = mesh.indices[t + 2u];
+		if (a == b || b == c || a == c) continue;
+		indices.insert(indices.end(), {a, b, c});
+
+		// area weighted
+		auto n = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+		normals[a] += n;
+		normals[b] += n;
+		normals[c] += n;
+		edge_sum += glm::distance(positions[a], positions[b])
+			+ glm::distance(positions[b], positions[c])
+			+ glm::distance(positions[c], positions[a]);
+	}
+	out.triangles = indices.size() / 3u;
+	if (out.triangles == 0u) {
+		throw std::runtime_error("mesh has no triangles");
+	}
+
+	out.vertices.resize(positions.size());
+	auto lo = glm::vec3(FLT_MAX);
+	auto hi = glm::vec3(-FLT_MAX);
+	for (usz v = 0u; v < positions.size(); v++) {
+		auto n = glm::length(normals[v]) > 0.0f ? normals[v] : glm::vec3(0.0f, 0.0f, 1.0f);
+		out.vertices[v] = MeshletVertex{ .pos = positions[v], .normal = pack_normal(n) };
+		lo = glm::min(lo, positions[v]);
+		hi = glm::max(hi, positions[v]);
+	}
+	out.center = (lo + hi) * 0.5f;
+	for (auto& p : positions) {
+		out.radius = std::max(out.radius, glm::distance(out.center, p));
+	}
+
+	// a cell of about twice the average edge merges most neighbours on the first pass
+	auto cell = static_cast<flt>(2.0 * edge_sum / static_cast<dbl>(indices.size()));
+
+	auto local = std::vector<u32>(positions.size(), NO_VERTEX);
+	auto dense = std::vector<u32>(positions.size(), NO_VERTEX);
+	auto level = std::vector<Cluster>{};
+	emit_meshlets(positions, std::move(indices), std::nullopt, 0.0f, cell, out, level, local, dense);
+	out.lod_levels = 1u;
+
+	auto group_of = std::vector<u32>(positions.size());
+	auto locked = std::vector<u8>(positions.size());
+	auto next = std::vector<Cluster>{};
+	for (u32 pass = 0u; pass < MAX_LOD_PASSES && level.size() > 1u; pass++) {
+		auto groups = group_clusters(level, out.meshlets, locked, group_of);
+
+		// vertices shared with another group are its border, they stay where they
+		// are so both groups can switch level on their own without cracks
+		std::fill(group_of.begin(), group_of.end(), NO_VERTEX);
+		std::fill(locked.begin(), locked.end(), u8{0u});
+		for (usz g = 0u; g < groups.size(); g++) {
+			for (auto c : groups[g]) {
+				for (auto v : level[c].indices) {
+					if (group_of[v] == NO_VERTEX) {
+						group_of[v] = cast<u32>(g);
+					} else if (group_of[v] != g) {
+						locked[v] = 1u;
+					}
+				}
+			}
+		}
+
+		next.clear();
+		auto simplified_any = false;
+		for (auto& members : groups) {
+			auto group = std::vector<Cluster*>{};
+			for (auto c : members) {
+				group.push_back(&level[c]);
+			}
+
+			auto group_indices = std::vector<u32>{};
+			auto sphere_lo = glm::vec3(FLT_MAX);
+			auto sphere_hi = glm::vec3(-FLT_MAX);
+			auto child_error = 0.0f;
+			for (auto* cluster : group) {
+				auto& m = out.meshlets[cluster->meshlet];
+				group_indices.insert(group_indices.end(), cluster->indices.begin(), cluster->indices.end());
+				sphere_lo = glm::min(sphere_lo, m.lod_center - m.lod_radius);
+				sphere_hi = glm::max(sphere_hi, m.lod_center + m.lod_radius);
+				child_error = std::max(child_error, m.lod_error);
+			}
+			// contains every child's sphere, so the error seen on screen only grows up the hierarchy
+			auto sphere = Sphere{ .center = (sphere_lo + sphere_hi) * 0.5f, .radius = 0.0f };
+			for (auto* cluster : group) {
+				auto& m = out.meshlets[cluster->meshlet];
+				sphere.radius = std::max(sphere.radius, glm::distance(sphere.center, m.lod_center) + m.lod_radius);
+			}
+
+			// coarser cells until the group loses enough, meshes with dense and sparse
+			// parts reach them at different levels
+			auto cell = 0.0f;
+			for (auto* cluster : group) {
+				cell = std::max(cell, cluster->cell);
+			}
+			auto simplified = std::vector<u32>{};
+			auto moved = 0.0f;
+			auto reduced = false;
+			for (u32 attempt = 0u; attempt < MAX_CELL_GROWTH && !reduced; attempt++, cell *= 2.0f) {
+				simplified.clear();
+				moved = simplify(positions, group_indices, locked, cell, simplified);
+				reduced = static_cast<flt>(simplified.size()) <= static_cast<flt>(group_indices.size()) * MIN_REDUCTION;
+			}
+			if (!reduced) {
+				// retried with the next level's groups
+				for (auto* cluster : group) {
+					cluster->cell = cell;
+					next.push_back(std::move(*cluster));
+				}
+				continue;
+			}
+			simplified_any = true;
+
+			auto error = child_error + moved;
+			for (auto* cluster : group) {
+				auto& m = out.meshlets[cluster->meshlet];
+				m.parent_center = sphere.center;
+				m.parent_radius = sphere.radius;
+				m.parent_error = error;
+			}
+			emit_meshlets(positions, std::move(simplified), sphere, error, cell, out, next, local, dense);
+		}
+
+		std::swap(level, next);
+		if (simplified_any) {
+			out.lod_levels++;
+		}
+	}
+
+	out.meshlet_triangles.resize((out.meshlet_triangles.size() + 3u) & ~usz{3u});
+	return out;
+}
+
+template<typename T>
+static void write_array(std::ofstream& out, const std::vector<T>& values) {
+	out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+// false without allocating when count runs past the end of the file
+template<typename T>
+static auto read_array(std::ifstream& in, u64 file_size, std::vector<T>& values, usz count) -> bool {
+	if (u64{count} * sizeof(T) > file_size - static_cast<u64>(in.tellg())) return false;
+	values.resize(count);
+	return static_cast<bool>(in.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(count * sizeof(T))));
+}
+
+void write_meshlet_container(const std::string& path, const MeshletMesh& mesh) {
+	auto out = std::ofstream(path, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) throw std::runtime_error("failed to open meshlet container for writing");
+
+	auto header = MeshletHeader {
+		.magic = MAGIC,
+		.version = VERSION,
+		.vertex_count = cast<u32>(mesh.vertices.size()),
+		.meshlet_vertex_count = cast<u32>(mesh.meshlet_vertices.size()),
+		.triangle_bytes = cast<u32>(mesh.meshlet_triangles.size()),
+		.meshlet_count = cast<u32>(mesh.meshlets.size()),
+		.lod_levels = mesh.lod_levels,
+		.pad = 0u,
+		.triangles = mesh.triangles,
+		.center = mesh.center,
+		.radius = mesh.radius,
+	};
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	write_array(out, mesh.vertices);
+	write_array(out, mesh.meshlet_vertices);
+	write_array(out, mesh.meshlet_triangles);
+	write_array(out, mesh.meshlets);
+	if (!out) throw std::runtime_error("failed to write meshlet container");
+}
+
+auto read_meshlet_container(const std::string& path) -> MeshletMesh {
+	auto in = std::ifstream(path, std::ios::binary | std::ios::ate);
+	if (!in.is_open()) throw std::runtime_error("failed to open meshlet container");
+	// the counts in the header are checked against it before anything is allocated
+	auto file_size = static_cast<u64>(in.tellg());
+	in.seekg(0);
+
+	auto header = MeshletHeader{};
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| header.magic != MAGIC
+		|| header.version != VERSION) {
+		throw std::runtime_error("not a meshlet container, or an unsupported version");
+	}
+
+	auto mesh = MeshletMesh{};
+	mesh.center = header.center;
+	mesh.radius = header.radius;
+	mesh.lod_levels = header.lod_levels;
+	mesh.triangles = header.triangles;
+	auto ok = read_array(in, file_size, mesh.vertices, header.vertex_count)
+		&& read_array(in, file_size, mesh.meshlet_vertices, header.meshlet_vertex_count)
+		&& read_array(in, file_size, mesh.meshlet_triangles, header.triangle_bytes)
+		&& read_array(in, file_size, mesh.meshlets, header.meshlet_count);
+	if (!ok) throw std::runtime_error("truncated meshlet container");
+	if (mesh.meshlets.empty()) throw std::runtime_error("meshlet container has no meshlets");
+	// the draw reads the triangles as whole words
+	if (mesh.meshlet_triangles.size() % 4u != 0u) throw std::runtime_error("corrupt meshlet container, triangles not padded");
+
+	// the offsets drive reads on the GPU, so they have to stay in their buffers
+	auto vertex_count = mesh.vertices.size();
+	for (auto index : mesh.meshlet_vertices) {
+		if (index >= vertex_count) throw std::runtime_error("corrupt meshlet container, vertex index out of range");
+	}
+	for (const auto& meshlet : mesh.meshlets) {
+		auto end = usz{meshlet.triangle_offset} + usz{meshlet.triangle_count} * 3u;
+		if (meshlet.triangle_count > MESHLET_MAX_TRIANGLES || end > mesh.meshlet_triangles.size()) {
+			throw std::runtime_error("corrupt meshlet container, triangles out of range");
+		}
+		for (auto i = usz{meshlet.triangle_offset}; i < end; i++) {
+			auto local = usz{mesh.meshlet_triangles[i]};
+			if (local >= MESHLET_MAX_VERTICES || meshlet.vertex_offset + local >= mesh.meshlet_vertices.size()) {
+				throw std::runtime_error("corrupt meshlet container, vertices out of range");
+			}
+		}
+	}
+	return mesh;
+}
+
+auto make_torus_mesh(u32 segments) -> Mesh {
+	constexpr auto major = 1.0f;
+	constexpr auto minor = 0.35f;
+	constexpr auto bump = 0.03f;
+	constexpr auto tau = 2.0f * std::numbers::pi_v<flt>;
+
+	segments = std::max(segments, 6u);
+	auto rings = segments / 2u;
+	auto mesh = Mesh{};
+	mesh.positions.reserve(usz{segments} * rings);
+	for (u32 i = 0u; i < segments; i++) {
+		auto u = tau * static_cast<flt>(i) / static_cast<flt>(segments);
+		for (u32 j = 0u; j < rings; j++) {
+			auto v = tau * static_cast<flt>(j) / static_cast<flt>(rings);
+			auto r = minor + bump * std::sin(24.0f * u) * std::sin(8.0f * v);
+			auto ring = major + r * std::cos(v);
+			mesh.positions.emplace_back(ring * std::cos(u), r * std::sin(v), ring * std::sin(u));
+		}
+	}
+
+	// counter-clockwise seen from outside
+	auto idx = [&](u32 i, u32 j) { return (i % segments) * rings + j % rings; };
+	mesh.indices.reserve(6u * usz{segments} * rings);
+	for (u32 i = 0u; i < segments; i++) {
+		for (u32 j = 0u; j < rings; j++) {
+			mesh.indices.insert(mesh.indices.end(), {idx(i, j), idx(i, j + 1u), idx(i + 1u, j)});
+			mesh.indices.insert(mesh.indices.end(), {idx(i + 1u, j), idx(i, j + 1u), idx(i + 1u, j + 1u)});
+		}
+	}
+	return mesh;
+}
+
+MeshletRenderer::MeshletRenderer(
+	vk::Device dev,
+	VulkanAllocator* alloc,
+	const MeshletMesh& mesh,
+	vk::Format color_fmt,
+	vk::Format depth_fmt,
+	usz frames_in_flight,
+	MeshletSettings settings
+) : dev{dev},
+	alloc{alloc},
+	settings{settings},
+	depth_fmt{depth_fmt},
+	frames_in_flight{frames_in_flight},
+	meshlet_count{cast<u32>(mesh.meshlets.size())},
+	center{mesh.center},
+	radius{mesh.radius} {
+	// empty buffers can't be created, and there would be nothing to draw
+	if (mesh.meshlets.empty()) throw std::runtime_error("meshlet mesh has no meshlets");
+
+	auto bytes = [](const auto& values) {
+		return static_cast<vk::DeviceSize>(values.size() * sizeof(values[0]));
+	};
+	auto storage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+	this->vertices = alloc->create_buffer(PoolKind::Geometry, bytes(mesh.vertices), storage);
+	this->meshlet_vertices = alloc->create_buffer(PoolKind::Geometry, bytes(mesh.meshlet_vertices), storage);
+	this->meshlet_triangles = alloc->create_buffer(PoolKind::Geometry, bytes(mesh.meshlet_triangles), storage);
+	this->meshlets = alloc->create_buffer(PoolKind::Geometry, bytes(mesh.meshlets), storage);
+	this->visible = alloc->create_buffer(PoolKind::Geometry, mesh.meshlets.size() * sizeof(u32), storage);
+	this->draw_args = alloc->create_buffer(
+		PoolKind::Geometry,
+		sizeof(vk::DrawIndirectCommand),
+		storage | vk::BufferUsageFlagBits::eIndirectBuffer
+	);
+
+	// copied into the device-local buffers by the first begin_frame
+	auto total = bytes(mesh.vertices) + bytes(mesh.meshlet_vertices) + bytes(mesh.meshlet_triangles) + bytes(mesh.meshlets);
+	this->staging = alloc->create_buffer(PoolKind::Staging, total, vk::BufferUsageFlagBits::eTransferSrc);
+	auto dst = static_cast<std::byte*>(this->staging->mapped);
+	for (auto [src, size] : {
+		std::pair{static_cast<const void*>(mesh.vertices.data()), bytes(mesh.vertices)},
+		std::pair{static_cast<const void*>(mesh.meshlet_vertices.data()), bytes(mesh.meshlet_vertices)},
+		std::pair{static_cast<const void*>(mesh.meshlet_triangles.data()), bytes(mesh.meshlet_triangles)},
+		std::pair{static_cast<const void*>(mesh.meshlets.data()), bytes(mesh.meshlets)},
+	}) {
+		std::memcpy(dst, src, size);
+		dst += size;
+	}
+	alloc->flush(this->staging, 0u, total);
+
+	this->cull_layout = create_shader_layout(dev, shaders::meshlet_cull);
+	this->draw_layout = create_shader_layout(dev, shaders::meshlet_draw);
+	this->cull_pipeline = this->build_cull();
+	this->draw_pipeline = this->build_draw(color_fmt);
+
+	auto sets = cast<u32>(frames_in_flight);
+	auto pool_size = vk::DescriptorPoolSize{}
+		.setType(vk::DescriptorType::eStorageBuffer)
+		.setDescriptorCount(sets * cast<u32>(shaders::meshlet_cull.bindings.size() + shaders::meshlet_draw.bindings.size()));
+	this->descriptor_pool = dev.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{}
+		.setMaxSets(2u * sets)
+		.setPoolSizes(pool_size)
+	);
+
+	auto cull_layouts = std::vector<vk::DescriptorSetLayout>(frames_in_flight, *this->cull_layout.set_layouts.at(0));
+	auto draw_layouts = std::vector<vk::DescriptorSetLayout>(frames_in_flight, *this->draw_layout.set_layouts.at(0));
+	this->cull_sets = dev.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{}
+		.setDescriptorPool(*this->descriptor_pool)
+		.setSetLayouts(cull_layouts)
+	);
+	this->draw_sets = dev.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{}
+		.setDescriptorPool(*this->descriptor_pool)
+		.setSetLayouts(draw_layouts)
+	);
+}
+
+// the owner waits for the device to be idle first
+MeshletRenderer::~MeshletRenderer() {
+	for (auto buf : {this->vertices, this->meshlet_vertices, this->meshlet_triangles, this->meshlets, this->visible, this->draw_args}) {
+		this->alloc->destroy_buffer(buf);
+	}
+	if (this->staging != nullptr) {
+		this->alloc->destroy_buffer(this->staging);
+	}
+	this->depth_view.reset();
+	if (this->depth != nullptr) {
+		this->alloc->destroy_image(this->depth);
+	}
+	for (auto& old : this->retired_depth) {
+		old.view.reset();
+		this->alloc->destroy_image(old.img);
+	}
+}
+
+void MeshletRenderer::begin_frame(vk::CommandBuffer cmd, usz sync_idx, u64 frame, flt dt) {
+	if (!this->uploaded) {
+		this->upload(cmd, frame);
+	} else if (this->staging != nullptr && frame >= this->upload_frame + this->frames_in_flight) {
+		this->alloc->destroy_buffer(this->staging);
+		this->staging = nullptr;
+	}
+	for (usz i = 0u; i < this->retired_depth.size();) {
+		if (frame >= this->retired_depth[i].frame + this->frames_in_flight) {
+			this->retired_depth[i].view.reset();
+			this->alloc->destroy_image(this->retired_depth[i].img);
+			this->retired_depth[i] = std::move(this->retired_depth.back());
+			this->retired_depth.pop_back();
+		} else {
+			i++;
+		}
+	}
+
+	this->write_sets(sync_idx);
+	this->sync_idx = sync_idx;
+	this->frame = frame;
+	this->orbit += this->settings.orbit_speed * dt;
+}
+
+void MeshletRenderer::upload(vk::CommandBuffer cmd, u64 frame) {
+	auto src_ofs = vk::DeviceSize{0u};
+	for (auto buf : {this->vertices, this->meshlet_vertices, this->meshlet_triangles, this->meshlets}) {
+		cmd.copyBuffer(this->staging->buf, buf->buf, vk::BufferCopy{src_ofs, 0u, buf->size});
+		src_ofs += buf->size;
+	}
+	auto args = vk::DrawIndirectCommand{3u * MESHLET_MAX_TRIANGLES, 0u, 0u, 0u};
+	cmd.updateBuffer(this->draw_args->buf, 0u, sizeof(args), &args);
+
+	auto barrier = vk::MemoryBarrier2{}
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eAllTransfer)
+		.setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader
+			| vk::PipelineStageFlagBits2::eVertexShader
+			| vk::PipelineStageFlagBits2::eDrawIndirect
+			| vk::PipelineStageFlagBits2::eClear)
+		.setDstAccessMask(vk::AccessFlagBits2::eShaderStorageRead
+			| vk::AccessFlagBits2::eShaderStorageWrite
+			| vk::AccessFlagBits2::eIndirectCommandRead
+			| vk::AccessFlagBits2::eTransferWrite);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(barrier));
+
+	this->upload_frame = frame;
+	this->uploaded = true;
+}
+
+void MeshletRenderer::draw(vk::CommandBuffer cmd, vk::ImageView color, vk::Extent2D extent) {
+	this->ensure_depth(extent);
+
+	// orbit at a varying distance so the levels of detail change
+	auto w = static_cast<flt>(extent.width);
+	auto h = static_cast<flt>(extent.height);
+	auto dist = this->radius * (2.5f + 1.5f * std::sin(this->orbit * 0.7f));
+	auto eye = this->center + glm::vec3(std::cos(this->orbit), 0.4f, std::sin(this->orbit)) * dist;
+	auto znear = this->radius * 0.01f;
+	auto proj = glm::perspectiveRH_ZO(this->settings.fov_y, w / h, znear, this->radius * 20.0f);
+	proj[1][1] *= -1.0f; // vulkan's y points down
+	auto view_proj = proj * glm::lookAtRH(eye, this->center, glm::vec3(0.0f, 1.0f, 0.0f));
+
+	// the previous pass, on another target or in the last frame, is done with the list
+	auto reset_barrier = vk::MemoryBarrier2{}
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eDrawIndirect
+			| vk::PipelineStageFlagBits2::eVertexShader
+			| vk::PipelineStageFlagBits2::eComputeShader)
+		.setSrcAccessMask(vk::AccessFlagBits2::eShaderStorageWrite)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eClear | vk::PipelineStageFlagBits2::eComputeShader)
+		.setDstAccessMask(vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eShaderStorageWrite);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(reset_barrier));
+	cmd.fillBuffer(this->draw_args->buf, offsetof(vk::DrawIndirectCommand, instanceCount), sizeof(u32), 0u);
+
+	auto cull_barrier = vk::MemoryBarrier2{}
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eClear)
+		.setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+		.setDstAccessMask(vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(cull_barrier));
+
+	auto cull_params = MeshletCullParams {
+		.view_proj = view_proj,
+		.camera = eye,
+		.proj_scale = h / (2.0f * std::tan(this->settings.fov_y * 0.5f)),
+		.error_px = this->settings.error_px,
+		.znear = znear,
+		.meshlet_count = this->meshlet_count,
+		.pad = 0u,
+	};
+	auto cull_layout = *this->cull_layout.pipeline_layout;
+	cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *this->cull_pipeline);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cull_layout, 0u, this->cull_sets[this->sync_idx], {});
+	cmd.pushConstants(cull_layout, vk::ShaderStageFlagBits::eCompute, 0u, sizeof(cull_params), &cull_params);
+	cmd.dispatch((this->meshlet_count + CULL_GROUP_SIZE - 1u) / CULL_GROUP_SIZE, 1u, 1u);
+
+	auto draw_barrier = vk::MemoryBarrier2{}
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+		.setSrcAccessMask(vk::AccessFlagBits2::eShaderStorageWrite)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eDrawIndirect | vk::PipelineStageFlagBits2::eVertexShader)
+		.setDstAccessMask(vk::AccessFlagBits2::eIndirectCommandRead | vk::AccessFlagBits2::eShaderStorageRead);
+	constexpr auto depth_stages = vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests;
+	auto depth_barrier = vk::ImageMemoryBarrier2{}
+		.setImage(this->depth->img)
+		.setSubresourceRange(vk::ImageSubresourceRange{}
+			.setAspectMask(vk::ImageAspectFlagBits::eDepth)
+			.setLevelCount(1u)
+			.setLayerCount(1u))
+		.setSrcStageMask(depth_stages)
+		.setSrcAccessMask(vk::AccessFlagBits2::eDepthStencilAttachmentWrite)
+		.setDstStageMask(depth_stages)
+		.setDstAccessMask(vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite)
+		.setOldLayout(vk::ImageLayout::eUndefined)
+		.setNewLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}
+		.setMemoryBarriers(draw_barrier)
+		.setImageMemoryBarriers(depth_barrier)
+	);
+
+	auto color_attach = vk::RenderingAttachmentInfo{}
+		.setImageView(color)
+		.setImageLayout(vk::ImageLayout::eColorAttachmentOptimal)
+		.setClearValue(vk::ClearColorValue{}.setFloat32({0.0f, 0.0f, 0.0f, 1.0f}))
+		.setLoadOp(vk::AttachmentLoadOp::eClear)
+		.setStoreOp(vk::AttachmentStoreOp::eStore);
+	auto depth_attach = vk::RenderingAttachmentInfo{}
+		.setImageView(*this->depth_view)
+		.setImageLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal)
+		.setClearValue(vk::ClearDepthStencilValue{1.0f, 0u})
+		.setLoadOp(vk::AttachmentLoadOp::eClear)
+		.setStoreOp(vk::AttachmentStoreOp::eDontCare);
+	cmd.beginRendering(vk::RenderingInfo{}
+		.setRenderArea({{0, 0}, extent})
+		.setLayerCount(1u)
+		.setColorAttachments(color_attach)
+		.setPDepthAttachment(&depth_attach)
+	);
+
+	auto draw_params = MeshletDrawParams {
+		.view_proj = view_proj,
+		.light_dir = glm::normalize(glm::vec3(0.4f, 1.0f, 0.3f)),
+		.show_clusters = this->settings.show_clusters ? 1u : 0u,
+	};
+	auto draw_layout = *this->draw_layout.pipeline_layout;
+	cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *this->draw_pipeline);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, draw_layout, 0u, this->draw_sets[this->sync_idx], {});
+	cmd.pushConstants(draw_layout, shaders::meshlet_draw.stages, 0u, sizeof(draw_params), &draw_params);
+	cmd.setViewport(0, vk::Viewport{0.0f, 0.0f, w, h, 0.0f, 1.0f});
+	cmd.setScissor(0, vk::Rect2D{{0, 0}, extent});
+	cmd.drawIndirect(this->draw_args->buf, 0u, 1u, sizeof(vk::DrawIndirectCommand));
+	cmd.endRendering();
+
+	// the scene pass loads what was drawn here
+	auto color_barrier = vk::MemoryBarrier2{}
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput)
+		.setSrcAccessMask(vk::AccessFlagBits2::eColorAttachmentWrite)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput)
+		.setDstAccessMask(vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(color_barrier));
+}
+
+// grows only, so several outputs of different sizes share one depth buffer.
+// An outgrown one may be used by a pass already recorded into this frame's
+// command buffer, so it is kept until the frame has retired.
+void MeshletRenderer::ensure_depth(vk::Extent2D extent) {
+	if (this->depth != nullptr && extent.width <= this->depth->extent.width && extent.height <= this->depth->extent.height) {
+		return;
+	}
+
+	auto size = vk::Extent3D{extent, 1u};
+	if (this->depth != nullptr) {
+		size.width = std::max(size.width, this->depth->extent.width);
+		size.height = std::max(size.height, this->depth->extent.height);
+		this->retired_depth.push_back(RetiredDepth{this->depth, std::move(this->depth_view), this->frame});
+		this->depth = nullptr;
+	}
+
+	this->depth = this->alloc->create_render_target(vk::ImageCreateInfo{}
+		.setImageType(vk::ImageType::e2D)
+		.setFormat(this->depth_fmt)
+		.setExtent(size)
+		.setMipLevels(1u)
+		.setArrayLayers(1u)
+		.setSamples(vk::SampleCountFlagBits::e1)
+		.setTiling(vk::ImageTiling::eOptimal)
+		.setUsage(vk::ImageUsageFlagBits::eDepthStencilAttachment)
+	);
+	this->depth_view = this->dev.createImageViewUnique(vk::ImageViewCreateInfo{}
+		.setImage(this->depth->img)
+		.setViewType(vk::ImageViewType::e2D)
+		.setFormat(this->depth_fmt)
+		.setSubresourceRange(vk::ImageSubresourceRange{}
+			.setAspectMask(vk::ImageAspectFlagBits::eDepth)
+			.setLevelCount(1u)
+			.setLayerCount(1u))
+	);
+}
+
+// the sets of sync_idx are idle, its previous frame has been waited on
+void MeshletRenderer::write_sets(usz sync_idx) {
+	auto whole = [](GpuBuffer* buf) {
+		return vk::DescriptorBufferInfo{buf->buf, 0u, vk::WholeSize};
+	};
+	auto vertices = whole(this->vertices);
+	auto meshlet_vertices = whole(this->meshlet_vertices);
+	auto meshlet_triangles = whole(this->meshlet_triangles);
+	auto meshlets = whole(this->meshlets);
+	auto visible = whole(this->visible);
+	auto draw_args = whole(this->draw_args);
+
+	auto write = [](vk::DescriptorSet set, const ShaderBinding& binding, const vk::DescriptorBufferInfo& info) {
+		return vk::WriteDescriptorSet{}
+			.setDstSet(set)
+			.setDstBinding(binding.binding)
+			.setDescriptorType(binding.type)
+			.setBufferInfo(info);
+	};
+	auto cull_set = this->cull_sets[sync_idx];
+	auto draw_set = this->draw_sets[sync_idx];
+	auto writes = std::array{
+		write(cull_set, shaders::meshlet_cull.binding("meshlets"), meshlets),
+		write(cull_set, shaders::meshlet_cull.binding("visible"), visible),
+		write(cull_set, shaders::meshlet_cull.binding("drawArgs"), draw_args),
+		write(draw_set, shaders::meshlet_draw.binding("vertices"), vertices),
+		write(draw_set, shaders::meshlet_draw.binding("meshletVertices"), meshlet_vertices),
+		write(draw_set, shaders::meshlet_draw.binding("meshletTriangles"), meshlet_triangles),
+		write(draw_set, shaders::meshlet_draw.binding("meshlets"), meshlets),
+		write(draw_set, shaders::meshlet_draw.binding("visible"), visible),
+	};
+	this->dev.updateDescriptorSets(writes, {});
+}
+
+auto MeshletRenderer::build_cull() const -> vk::UniquePipeline {
+	auto module = this->dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo{}
+		.setCodeSize(shaders::meshlet_cull.spirv.size() * sizeof(u32))
+		.setPCode(shaders::meshlet_cull.spirv.data())
+	);
+	constexpr auto entry_point = shaders::meshlet_cull.entry_point(vk::ShaderStageFlagBits::eCompute);
+	auto result = this->dev.createComputePipelineUnique(nullptr, vk::ComputePipelineCreateInfo{}
+		.setStage(vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *module, entry_point))
+		.setLayout(*this->cull_layout.pipeline_layout)
+	);
+	if (result.result != vk::Result::eSuccess) {
+		throw std::runtime_error("Failed to create meshlet cull pipeline");
+	}
+	return std::move(result.value);
+}
+
+auto MeshletRenderer::build_draw(vk::Format color_fmt) const -> vk::UniquePipeline {
+	auto module = this->dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo{}
+		.setCodeSize(shaders::meshlet_draw.spirv.size() * sizeof(u32))
+		.setPCode(shaders::meshlet_draw.spirv.data())
+	);
+
+	constexpr auto vert_main = shaders::meshlet_draw.entry_point(vk::ShaderStageFlagBits::eVertex);
+	constexpr auto frag_main = shaders::meshlet_draw.entry_point(vk::ShaderStageFlagBits::eFragment);
+	auto shader_stages = std::array{
+		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *module, vert_main),
+		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *module, frag_main),
+	};
+
+	// vertices are pulled from the storage buffers
+	auto vertex_input = vk::PipelineVertexInputStateCreateInfo{};
+	auto input_assembly = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList);
+	auto viewport_state = vk::PipelineViewportStateCreateInfo({}, 1, nullptr, 1, nullptr);
+	// with y flipped in the projection, triangles counter-clockwise from outside stay so on screen
+	auto rasterizer = vk::PipelineRasterizationStateCreateInfo{}
+		.setPolygonMode(vk::PolygonMode::eFill)
+		.setCullMode(vk::CullModeFlagBits::eBack)
+		.setFrontFace(vk::FrontFace::eCounterClockwise)
+		.setLineWidth(1.0f);
+	auto multisample = vk::PipelineMultisampleStateCreateInfo{}.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+	auto depth_stencil = vk::PipelineDepthStencilStateCreateInfo{}
+		.setDepthTestEnable(true)
+		.setDepthWriteEnable(true)
+		.setDepthCompareOp(vk::CompareOp::eLess);
+
+	auto color_blend_attachment = vk::PipelineColorBlendAttachmentState{}
+		.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+	auto color_blend = vk::PipelineColorBlendStateCreateInfo{}.setAttachments(color_blend_attachment);
+
+	auto dynamic_states = std::array{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+	auto dynamic_info = vk::PipelineDynamicStateCreateInfo{}.setDynamicStates(dynamic_states);
+
+	auto pipeline_rendering_info = vk::PipelineRenderingCreateInfo{}
+		.setColorAttachmentFormats(color_fmt)
+		.setDepthAttachmentFormat(this->depth_fmt);
+
+	auto pipeline_info = vk::GraphicsPipelineCreateInfo{}
+		.setPNext(&pipeline_rendering_info)
+		.setStages(shader_stages)
+		.setPVertexInputState(&vertex_input)
+		.setPInputAssemblyState(&input_assembly)
+		.setPViewportState(&viewport_state)
+		.setPRasterizationState(&rasterizer)
+		.setPMultisampleState(&multisample)
+		.setPDepthStencilState(&depth_stencil)
+		.setPColorBlendState(&color_blend)
+		.setPDynamicState(&dynamic_info)
+		.setLayout(*this->draw_layout.pipeline_layout);
+
+	auto result = this->dev.createGraphicsPipelineUnique(nullptr, pipeline_info);
+	if (result.result != vk::Result::eSuccess) {
+		throw std::runtime_error("Failed to create meshlet pipeline");
+	}
+	return std::move(result.value);
+}
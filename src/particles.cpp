@@ -0,0 +1,286 @@
+#include "particles.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+#include "shaders/particle_draw.hpp"
+#include "shaders/particle_sim.hpp"
+
+// numthreads of emit and simulate in particle_sim.slang
+static constexpr u32 GROUP_SIZE = 256u;
+// a hitch should not fire a whole second of particles at once
+static constexpr flt MAX_DT = 0.1f;
+
+// every binding is written into set 0
+static_assert(shaders::particle_sim.binding("particlesIn").set == 0u);
+static_assert(shaders::particle_sim.binding("particlesOut").set == 0u);
+static_assert(shaders::particle_sim.binding("counters").set == 0u);
+static_assert(shaders::particle_draw.binding("particles").set == 0u);
+static_assert(shaders::particle_sim.stages == vk::ShaderStageFlagBits::eCompute);
+
+ParticleSystem::ParticleSystem(
+	vk::Device dev,
+	VulkanAllocator* alloc,
+	std::span<const u32> queue_families,
+	vk::Format color_fmt,
+	usz frames_in_flight,
+	ParticleSettings settings
+) : dev{dev}, alloc{alloc}, settings{settings} {
+	for (auto& buf : this->particles) {
+		buf = alloc->create_buffer(
+			PoolKind::Geometry,
+			u64{settings.capacity} * sizeof(Particle),
+			vk::BufferUsageFlagBits::eStorageBuffer,
+			queue_families
+		);
+	}
+	this->counters = alloc->create_buffer(
+		PoolKind::Geometry,
+		2u * sizeof(ParticleCounters),
+		vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+		queue_families
+	);
+
+	this->sim_layout = create_shader_layout(dev, shaders::particle_sim);
+	this->draw_layout = create_shader_layout(dev, shaders::particle_draw);
+	this->emit_pipeline = this->build_compute(shaders::particle_sim.entry_point("emit"));
+	this->simulate_pipeline = this->build_compute(shaders::particle_sim.entry_point("simulate"));
+	this->finalize_pipeline = this->build_compute(shaders::particle_sim.entry_point("finalize"));
+	this->draw_pipeline = this->build_draw(color_fmt);
+
+	auto sets = cast<u32>(frames_in_flight);
+	auto pool_size = vk::DescriptorPoolSize{}
+		.setType(vk::DescriptorType::eStorageBuffer)
+		.setDescriptorCount(sets * cast<u32>(shaders::particle_sim.bindings.size() + shaders::particle_draw.bindings.size()));
+	this->descriptor_pool = dev.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{}
+		.setMaxSets(2u * sets)
+		.setPoolSizes(pool_size)
+	);
+
+	auto sim_layouts = std::vector<vk::DescriptorSetLayout>(frames_in_flight, *this->sim_layout.set_layouts.at(0));
+	auto draw_layouts = std::vector<vk::DescriptorSetLayout>(frames_in_flight, *this->draw_layout.set_layouts.at(0));
+	this->sim_sets = dev.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{}
+		.setDescriptorPool(*this->descriptor_pool)
+		.setSetLayouts(sim_layouts)
+	);
+	this->draw_sets = dev.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{}
+		.setDescriptorPool(*this->descriptor_pool)
+		.setSetLayouts(draw_layouts)
+	);
+}
+
+// the owner waits for the device to be idle first
+ParticleSystem::~ParticleSystem() {
+	for (auto buf : this->particles) {
+		this->alloc->destroy_buffer(buf);
+	}
+	this->alloc->destroy_buffer(this->counters);
+}
+
+void ParticleSystem::simulate(vk::CommandBuffer cmd, usz sync_idx, flt dt, bool graphics_queue) {
+	auto dst = 1u - this->src;
+	this->write_sets(sync_idx, dst);
+
+	auto prev_stages = vk::PipelineStageFlagBits2::eComputeShader;
+	if (graphics_queue) {
+		prev_stages |= DRAW_STAGES;
+	}
+	if (!this->initialized) {
+		// zero counts, and zero sized dispatches for the first simulate
+		cmd.fillBuffer(this->counters->buf, 0u, vk::WholeSize, 0u);
+		prev_stages |= vk::PipelineStageFlagBits2::eClear;
+		this->initialized = true;
+	}
+
+	// the previous step's results (and on the graphics queue, the draws of them) are done
+	auto begin_barrier = vk::MemoryBarrier2{}
+		.setSrcStageMask(prev_stages)
+		.setSrcAccessMask(vk::AccessFlagBits2::eShaderStorageWrite | vk::AccessFlagBits2::eTransferWrite)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader | vk::PipelineStageFlagBits2::eDrawIndirect)
+		.setDstAccessMask(vk::AccessFlagBits2::eShaderStorageRead
+			| vk::AccessFlagBits2::eShaderStorageWrite
+			| vk::AccessFlagBits2::eIndirectCommandRead);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(begin_barrier));
+
+	dt = std::min(dt, MAX_DT);
+	this->emit_carry += this->settings.emit_rate * dt;
+	auto emit_count = static_cast<u32>(this->emit_carry);
+	this->emit_carry -= static_cast<flt>(emit_count);
+
+	auto params = ParticleSimParams {
+		.emitter = this->settings.emitter,
+		.dt = dt,
+		.gravity = this->settings.gravity,
+		.emit_count = emit_count,
+		.capacity = this->settings.capacity,
+		.src = this->src,
+		.seed = this->seed++,
+		.lifetime = this->settings.lifetime,
+	};
+	auto layout = *this->sim_layout.pipeline_layout;
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0u, this->sim_sets[sync_idx], {});
+	cmd.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0u, sizeof(params), &params);
+
+	auto append_barrier = vk::MemoryBarrier2{}
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+		.setSrcAccessMask(vk::AccessFlagBits2::eShaderStorageWrite)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+		.setDstAccessMask(vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite);
+	auto append_dep = vk::DependencyInfo{}.setMemoryBarriers(append_barrier);
+
+	cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *this->simulate_pipeline);
+	cmd.dispatchIndirect(
+		this->counters->buf,
+		this->src * sizeof(ParticleCounters) + offsetof(ParticleCounters, dispatch)
+	);
+	// survivors append first, emit only fills what capacity is left
+	if (emit_count > 0u) {
+		cmd.pipelineBarrier2(append_dep);
+		cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *this->emit_pipeline);
+		cmd.dispatch((emit_count + GROUP_SIZE - 1u) / GROUP_SIZE, 1u, 1u);
+	}
+	cmd.pipelineBarrier2(append_dep);
+
+	cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *this->finalize_pipeline);
+	cmd.dispatch(1u, 1u, 1u);
+
+	if (graphics_queue) {
+		auto draw_barrier = vk::MemoryBarrier2{}
+			.setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+			.setSrcAccessMask(vk::AccessFlagBits2::eShaderStorageWrite)
+			.setDstStageMask(DRAW_STAGES)
+			.setDstAccessMask(vk::AccessFlagBits2::eIndirectCommandRead | vk::AccessFlagBits2::eShaderStorageRead);
+		cmd.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(draw_barrier));
+	}
+
+	this->src = dst;
+}
+
+void ParticleSystem::draw(vk::CommandBuffer cmd, vk::Extent2D extent) const {
+	auto layout = *this->draw_layout.pipeline_layout;
+	cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *this->draw_pipeline);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0u, this->draw_set, {});
+
+	auto w = static_cast<flt>(extent.width);
+	auto h = static_cast<flt>(extent.height);
+	cmd.setViewport(0, vk::Viewport{0.0f, 0.0f, w, h, 0.0f, 1.0f});
+	cmd.setScissor(0, vk::Rect2D{{0, 0}, extent});
+
+	auto params = ParticleDrawParams {
+		.aspect = {std::min(w, h) / w, std::min(w, h) / h},
+		.lifetime = this->settings.lifetime,
+		.pad = 0.0f,
+	};
+	cmd.pushConstants(layout, shaders::particle_draw.stages, 0u, sizeof(params), &params);
+
+	// the last step compacted into what is now src
+	cmd.drawIndirect(
+		this->counters->buf,
+		this->src * sizeof(ParticleCounters) + offsetof(ParticleCounters, draw),
+		1u,
+		sizeof(vk::DrawIndirectCommand)
+	);
+}
+
+auto ParticleSystem::build_compute(const char* entry_point) const -> vk::UniquePipeline {
+	auto module = this->dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo{}
+		.setCodeSize(shaders::particle_sim.spirv.size() * sizeof(u32))
+		.setPCode(shaders::particle_sim.spirv.data())
+	);
+	auto result = this->dev.createComputePipelineUnique(nullptr, vk::ComputePipelineCreateInfo{}
+		.setStage(vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *module, entry_point))
+		.setLayout(*this->sim_layout.pipeline_layout)
+	);
+	if (result.result != vk::Result::eSuccess) {
+		throw std::runtime_error("Failed to create particle compute pipeline");
+	}
+	return std::move(result.value);
+}
+
+auto ParticleSystem::build_draw(vk::Format color_fmt) const -> vk::UniquePipeline {
+	auto module = this->dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo{}
+		.setCodeSize(shaders::particle_draw.spirv.size() * sizeof(u32))
+		.setPCode(shaders::particle_draw.spirv.data())
+	);
+
+	constexpr auto vert_main = shaders::particle_draw.entry_point(vk::ShaderStageFlagBits::eVertex);
+	constexpr auto frag_main = shaders::particle_draw.entry_point(vk::ShaderStageFlagBits::eFragment);
+	auto shader_stages = std::array{
+		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *module, vert_main),
+		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *module, frag_main),
+	};
+
+	// quads are expanded from the particle index in the vertex shader
+	auto vertex_input = vk::PipelineVertexInputStateCreateInfo{};
+	auto input_assembly = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList);
+	auto viewport_state = vk::PipelineViewportStateCreateInfo({}, 1, nullptr, 1, nullptr);
+	auto rasterizer = vk::PipelineRasterizationStateCreateInfo{}
+		.setPolygonMode(vk::PolygonMode::eFill)
+		.setCullMode(vk::CullModeFlagBits::eNone)
+		.setLineWidth(1.0f);
+	auto multisample = vk::PipelineMultisampleStateCreateInfo{}.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+
+	// additive, so the particles need no sorting
+	auto color_blend_attachment = vk::PipelineColorBlendAttachmentState{}
+		.setBlendEnable(true)
+		.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+		.setDstColorBlendFactor(vk::BlendFactor::eOne)
+		.setColorBlendOp(vk::BlendOp::eAdd)
+		.setSrcAlphaBlendFactor(vk::BlendFactor::eZero)
+		.setDstAlphaBlendFactor(vk::BlendFactor::eOne)
+		.setAlphaBlendOp(vk::BlendOp::eAdd)
+		.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+	auto color_blend = vk::PipelineColorBlendStateCreateInfo{}.setAttachments(color_blend_attachment);
+
+	auto dynamic_states = std::array{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+	auto dynamic_info = vk::PipelineDynamicStateCreateInfo{}.setDynamicStates(dynamic_states);
+
+	auto pipeline_rendering_info = vk::PipelineRenderingCreateInfo{}
+		.setColorAttachmentFormats(color_fmt);
+
+	auto pipeline_info = vk::GraphicsPipelineCreateInfo{}
+		.setPNext(&pipeline_rendering_info)
+		.setStages(shader_stages)
+		.setPVertexInputState(&vertex_input)
+		.setPInputAssemblyState(&input_assembly)
+		.setPViewportState(&viewport_state)
+		.setPRasterizationState(&rasterizer)
+		.setPMultisampleState(&multisample)
+		.setPColorBlendState(&color_blend)
+		.setPDynamicState(&dynamic_info)
+		.setLayout(*this->draw_layout.pipeline_layout);
+
+	auto result = this->dev.createGraphicsPipelineUnique(nullptr, pipeline_info);
+	if (result.result != vk::Result::eSuccess) {
+		throw std::runtime_error("Failed to create particle pipeline");
+	}
+	return std::move(result.value);
+}
+
+// the sets of sync_idx are idle, its previous frame has been waited on
+void ParticleSystem::write_sets(usz sync_idx, u32 dst) {
+	auto whole = [](GpuBuffer* buf) {
+		return vk::DescriptorBufferInfo{buf->buf, 0u, vk::WholeSize};
+	};
+	auto in = whole(this->particles[this->src]);
+	auto out = whole(this->particles[dst]);
+	auto counters = whole(this->counters);
+
+	auto write = [](vk::DescriptorSet set, const ShaderBinding& binding, const vk::DescriptorBufferInfo& info) {
+		return vk::WriteDescriptorSet{}
+			.setDstSet(set)
+			.setDstBinding(binding.binding)
+			.setDescriptorType(binding.type)
+			.setBufferInfo(info);
+	};
+	auto sim_set = this->sim_sets[sync_idx];
+	auto writes = std::array{
+		write(sim_set, shaders::particle_sim.binding("particlesIn"), in),
+		write(sim_set, shaders::particle_sim.binding("particlesOut"), out),
+		write(sim_set, shaders::particle_sim.binding("counters"), counters),
+		write(this->draw_sets[sync_idx], shaders::particle_draw.binding("particles"), out),
+	};
+	this->dev.updateDescriptorSets(writes, {});
+	this->draw_set = this->draw_sets[sync_idx];
+}
@@ -2,15 +2,18 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
 #include <limits>
 #include <optional>
 #include <stdexcept>
+#include <utility>
 
 #include <glm/ext/vector_float2.hpp>
 #include <glm/ext/vector_float3.hpp>
+#include <glm/ext/vector_float4.hpp>
 #include <glm/ext/vector_int2.hpp>
 #include <glm/ext/vector_uint2.hpp>
 #include <SDL.h>
@@ -26,8 +29,12 @@
 #include <vulkan/vulkan_hpp_macros.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
+#include "latency.hpp"
+#include "meshlet.hpp"
+#include "particles.hpp"
 #include "sugar.hpp"
 #include "shader.hpp"
+#include "shaders/triangle.hpp"
 #include "vma.hpp"
 
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
@@ -36,45 +43,38 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 constexpr auto VK_VER = vk::makeApiVersion(0, 1, 3, 0);
 constexpr u32 MIN_IMGS = 3u;
 
-struct Vertex {
-	glm::vec2 pos;
-	glm::vec3 color;
-
-	static auto get_binding() -> vk::VertexInputBindingDescription {
-		auto ret = vk::VertexInputBindingDescription{}
-			.setBinding(0)
-			.setStride(sizeof(Vertex))
-			.setInputRate(vk::VertexInputRate::eVertex);
-		return ret;
-	}
-
-	static auto get_attr_descs() -> std::array<vk::VertexInputAttributeDescription, 2> {
-		return std::array{
-			vk::VertexInputAttributeDescription{}
-				.setBinding(0)
-				.setLocation(0)
-				.setFormat(vk::Format::eR32G32Sfloat)
-				.setOffset(offsetof(Vertex, pos)),
-			vk::VertexInputAttributeDescription{}
-				.setBinding(0)
-				.setLocation(1)
-				.setFormat(vk::Format::eR32G32B32Sfloat)
-				.setOffset(offsetof(Vertex, color)),
-		};
-	}
+// read by index from inPos and inColor in triangle.slang
+static constexpr auto SCENE_POS = std::array{
+	glm::vec2(0.0f, -0.5f),
+	glm::vec2(0.5f, 0.5f),
+	glm::vec2(-0.5f, 0.5f),
 };
-const std::vector<Vertex> verts = {
-	{{0.0, -0.5}, {1.0, 0.0, 0.0}},
-	{{0.5, 0.5}, {0.0, 1.0, 0.0}},
-	{{-0.5, 0.5}, {0.0, 0.0, 1.0}},
+// float3 elements are 16 bytes apart in a std430 buffer
+static constexpr auto SCENE_COLOR = std::array{
+	glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+	glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+	glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
 };
 
+// the pipeline is built from exactly these stages
+static_assert(shaders::triangle.stages == (vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment));
+
 static constexpr auto QU_PRIOS = std::array{1.0f};
 static constexpr auto DEV_EXTS = std::array{VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+// start compacting geometry once any heap is this close to its budget
+static constexpr auto DEFRAG_PRESSURE = 0.85f;
+static constexpr u64 PRESSURE_CHECK_INTERVAL = 120u;
+static constexpr auto OFFSCREEN_FMT = vk::Format::eR8G8B8A8Srgb;
 static constexpr auto SRGB_FMTS = std::array{
 	vk::Format::eR8G8B8A8Srgb,
 	vk::Format::eB8G8R8A8Srgb,
 };
+// meshlet depth buffer, the first with attachment support is used
+static constexpr auto DEPTH_FMTS = std::array{
+	vk::Format::eD32Sfloat,
+	vk::Format::eX8D24UnormPack32,
+	vk::Format::eD16Unorm,
+};
 static constexpr auto SUBRESOURCE_RANGE = vk::ImageSubresourceRange{}
 	.setAspectMask(vk::ImageAspectFlagBits::eColor)
 	.setLayerCount(1)
@@ -86,11 +86,14 @@ static void require_success(vk::Result res, const char* msg) {
 	}
 }
 
-Window::Window() {
-	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+Window::Window(u32 display) {
+	// reference counted, so every window can init and quit it
+	if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
 		throw std::runtime_error(SDL_GetError());
 	}
-	auto ptr = SDL_CreateWindow("vk", -1, -1, 800, 600, SDL_WINDOW_SHOWN | SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+	display %= cast<u32>(std::max(SDL_GetNumVideoDisplays(), 1));
+	auto pos = cast<int>(SDL_WINDOWPOS_UNDEFINED_DISPLAY(display));
+	auto ptr = SDL_CreateWindow("vk", pos, pos, 800, 600, SDL_WINDOW_SHOWN | SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
 	// auto ptr = SDL_CreateWindow("vk", -1, -1, 800, 600, SDL_WINDOW_SHOWN | SDL_WINDOW_VULKAN);
 	if (ptr == nullptr) {
 		throw std::runtime_error(SDL_GetError());
@@ -107,7 +110,10 @@ Window::Window() {
 
 Window::~Window() {
 	SDL_DestroyWindow(this->inner);
-	SDL_Quit();
+	SDL_QuitSubSystem(SDL_INIT_VIDEO);
+	if (SDL_WasInit(0u) == 0u) {
+		SDL_Quit();
+	}
 }
 
 static bool needs_recreation(vk::Result res) {
@@ -145,6 +151,8 @@ bool Swapchain::recreate(glm::ivec2 sz) {
 		})
 		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
 		.set_desired_min_image_count(MIN_IMGS)
+		// dynamic resolution blits the scene into the swapchain image
+		.set_image_usage_flags(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT)
 		.set_old_swapchain(this->inner ? *this->inner : VK_NULL_HANDLE)
 		.build();
 
@@ -190,29 +198,6 @@ bool Swapchain::recreate(glm::ivec2 sz) {
 	return true;
 }
 
-bool Swapchain::present(vk::Queue qu) {
-	if (!this->img_idx.has_value()) {
-		return true;
-	}
-
-	auto img_idx = this->img_idx.value();
-	auto to_wait = *this->render_sems.at(img_idx);
-	auto present_info = vk::PresentInfoKHR{}
-		.setSwapchains(*this->inner)
-		.setImageIndices(img_idx)
-		.setWaitSemaphores(to_wait);
-
-	vk::Result res;
-	try {
-		res = qu.presentKHR(&present_info);
-	} catch (vk::OutOfDateKHRError&) {
-		res = vk::Result::eErrorOutOfDateKHR;
-	}
-
-	this->img_idx.reset();
-	return !needs_recreation(res);
-}
-
 auto Swapchain::acq_next_img(vk::Semaphore to_sig) -> std::optional<RenderTarget> {
 	assert(!this->img_idx.has_value());
 	u32 img_idx = 0u;
@@ -242,14 +227,6 @@ auto Swapchain::acq_next_img(vk::Semaphore to_sig) -> std::optional<RenderTarget
 	};
 }
 
-auto Swapchain::base_barrier() const -> vk::ImageMemoryBarrier2 {
-	return vk::ImageMemoryBarrier2{}
-		.setImage(this->imgs.at(this->img_idx.value()))
-		.setSubresourceRange(SUBRESOURCE_RANGE)
-		.setSrcQueueFamilyIndex(this->gpu.qu_fam_idx)
-		.setDstQueueFamilyIndex(this->gpu.qu_fam_idx);
-}
-
 auto Swapchain::get_size() const -> glm::ivec2 {
 	return {this->cinfo.imageExtent.width, this->cinfo.imageExtent.height};
 }
@@ -258,20 +235,47 @@ auto Swapchain::get_sem() const -> vk::Semaphore {
 	return *this->render_sems.at(this->img_idx.value());
 }
 
-Renderer::Renderer(Window* win) {
-	auto vkb_inst = this->init_inst(win);
+Renderer::Renderer(Window* win)
+	: Renderer(win == nullptr ? std::span<Window* const>{} : std::span<Window* const>(&win, 1u)) {}
 
-	auto surf_inner = VkSurfaceKHR{};
-	if (!SDL_Vulkan_CreateSurface(win->inner, *this->inst, &surf_inner)) {
-		throw std::runtime_error(SDL_GetError());
+Renderer::Renderer(std::span<Window* const> wins) {
+	auto vkb_inst = this->init_inst(wins);
+
+	for (auto win : wins) {
+		auto surf_inner = VkSurfaceKHR{};
+		if (!SDL_Vulkan_CreateSurface(win->inner, *this->inst, &surf_inner)) {
+			throw std::runtime_error(SDL_GetError());
+		}
+		this->outputs.push_back(Output{ .surf = vk::UniqueSurfaceKHR{surf_inner, *this->inst} });
 	}
-	this->surf = vk::UniqueSurfaceKHR{surf_inner, *this->inst};
 
 	this->init_devs(vkb_inst);
-	this->swapchain.emplace(this->gpu, *this->dev, *this->surf, win->sz);
+	for (usz i = 0u; i < wins.size(); i++) {
+		auto& output = this->outputs[i];
+		output.swapchain.emplace(this->gpu, *this->dev, *output.surf, wins[i]->sz);
+		// the pipelines are built for a single color format
+		if (output.swapchain->cinfo.imageFormat != this->outputs.front().swapchain->cinfo.imageFormat) {
+			throw std::runtime_error("all windows need the same swapchain format");
+		}
+	}
+	if (this->outputs.empty()) {
+		this->outputs.emplace_back();
+	}
 	this->init_sync();
 
-	this->alloc = VulkanAllocator(this->inst.get(), this->gpu.pdev, this->dev.get());
+	this->alloc = VulkanAllocator(this->inst.get(), this->gpu.pdev, this->dev.get(), this->gpu.has_mem_budget);
+	if (!this->alloc.dynamic_writes_direct()) {
+		std::cerr << "no device-local host-visible memory, per-frame data goes through staging" << std::endl;
+	}
+
+	// textures may take half of the largest device-local heap
+	auto tex_budget = u64{0u};
+	for (auto& heap : this->alloc.heap_budgets()) {
+		if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+			tex_budget = std::max(tex_budget, heap.budget / 2u);
+		}
+	}
+	this->texture_streamer.emplace(*this->dev, &this->alloc, tex_budget, this->render_sync.size());
 
 	this->init_pipeline();
 }
@@ -280,9 +284,141 @@ Renderer::~Renderer() {
 	if (this->dev) {
 		this->dev->waitIdle();
 	}
+	for (auto& output : this->outputs) {
+		this->destroy_color_target(output.offscreen);
+		this->destroy_color_target(output.scene);
+	}
+}
+
+void Renderer::wait_idle() {
+	this->dev->waitIdle();
+}
+
+auto Renderer::last_record_ns() const -> u64 {
+	return this->record_ns;
+}
+
+auto Renderer::last_gpu_ns() const -> u64 {
+	return this->gpu_ns;
+}
+
+void Renderer::set_target_frame_time(std::optional<flt> ms) {
+	if (!ms.has_value()) {
+		this->dynres.reset();
+		this->dev->waitIdle();
+		for (auto& output : this->outputs) {
+			this->destroy_color_target(output.scene);
+		}
+		return;
+	}
+
+	constexpr auto needed = vk::FormatFeatureFlagBits::eBlitSrc
+		| vk::FormatFeatureFlagBits::eBlitDst
+		| vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+	auto feats = this->gpu.pdev.getFormatProperties(this->color_fmt()).optimalTilingFeatures;
+	if ((feats & needed) != needed) {
+		std::cerr << "color format cannot be blitted, dynamic resolution disabled" << std::endl;
+		return;
+	}
+	if (!this->timestamps) {
+		std::cerr << "no GPU timestamps, dynamic resolution stays at full scale" << std::endl;
+	}
+	this->dynres.emplace(ms.value());
+}
+
+void Renderer::enable_particles(const ParticleSettings& settings) {
+	// emit and simulate compact with subgroup ballots
+	auto props = this->gpu.pdev.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+	auto& subgroup = props.get<vk::PhysicalDeviceSubgroupProperties>();
+	constexpr auto needed = vk::SubgroupFeatureFlagBits::eBasic | vk::SubgroupFeatureFlagBits::eBallot;
+	if ((subgroup.supportedOperations & needed) != needed
+		|| !(subgroup.supportedStages & vk::ShaderStageFlagBits::eCompute)) {
+		std::cerr << "no subgroup ballots in compute shaders, particles disabled" << std::endl;
+		return;
+	}
+
+	this->dev->waitIdle();
+	this->particles.reset();
+	auto families = std::vector<u32>{this->gpu.qu_fam_idx};
+	if (this->gpu.compute_fam_idx.has_value()) {
+		families.push_back(this->gpu.compute_fam_idx.value());
+	}
+	this->particles.emplace(*this->dev, &this->alloc, families, this->color_fmt(), this->render_sync.size(), settings);
+}
+
+void Renderer::enable_meshlets(const MeshletMesh& mesh, const MeshletSettings& settings) {
+	auto depth_fmt = std::find_if(DEPTH_FMTS.begin(), DEPTH_FMTS.end(), [this](vk::Format fmt) {
+		auto feats = this->gpu.pdev.getFormatProperties(fmt).optimalTilingFeatures;
+		return static_cast<bool>(feats & vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+	});
+	if (depth_fmt == DEPTH_FMTS.end()) {
+		std::cerr << "no depth attachment format, meshlets disabled" << std::endl;
+		return;
+	}
+
+	this->dev->waitIdle();
+	this->meshlets.reset();
+	this->meshlets.emplace(*this->dev, &this->alloc, mesh, this->color_fmt(), *depth_fmt, this->render_sync.size(), settings);
+}
+
+auto Renderer::output_count() const -> usz {
+	return this->outputs.size();
+}
+
+auto Renderer::render_scale() const -> flt {
+	return this->dynres.has_value() ? this->dynres->scale() : 1.0f;
+}
+
+auto Renderer::textures() -> TextureStreamer& {
+	return *this->texture_streamer;
+}
+
+auto Renderer::latency() const -> const LatencyTracker& {
+	return this->latency_tracker;
+}
+
+void Renderer::show_latency_overlay(bool show) {
+	if (show == this->latency_overlay.has_value()) return;
+	this->dev->waitIdle();
+	this->latency_overlay.reset();
+	if (show) {
+		this->latency_overlay.emplace(*this->dev, &this->alloc, this->color_fmt(), this->render_sync.size());
+	}
 }
 
-auto Renderer::init_inst(Window* win) -> vkb::Instance {
+void Renderer::poll_presents() {
+	if (!this->gpu.has_present_wait) return;
+
+	// oldest first, so frames are recorded in order, the last present used slot img_idx
+	for (usz n = 1u; n <= PENDING_FRAMES; n++) {
+		auto slot = (this->img_idx + n) % PENDING_FRAMES;
+		auto& frame = this->pending_frames[slot];
+		if (frame.outstanding == 0u) continue;
+
+		for (auto& output : this->outputs) {
+			auto& id = output.present_ids[slot];
+			if (id == 0u) continue;
+			// a zero timeout only polls, the call does not throw on eTimeout this way
+			auto res = static_cast<vk::Result>(VULKAN_HPP_DEFAULT_DISPATCHER.vkWaitForPresentKHR(
+				*this->dev, *output.swapchain->inner, id, 0u
+			));
+			if (res == vk::Result::eTimeout) continue;
+			if (res == vk::Result::eSuccess || res == vk::Result::eSuboptimalKHR) {
+				// the frame is on screen once every window shows it
+				frame.stamps.present_ns = std::max(frame.stamps.present_ns, steady_ns());
+			} else {
+				frame.dropped = true;
+			}
+			id = 0u;
+			frame.outstanding--;
+		}
+		if (frame.outstanding == 0u && !frame.dropped) {
+			this->latency_tracker.record(frame.stamps);
+		}
+	}
+}
+
+auto Renderer::init_inst(std::span<Window* const> wins) -> vkb::Instance {
 	VULKAN_HPP_DEFAULT_DISPATCHER.init();
 
 	auto inst_builder = vkb::InstanceBuilder{}
@@ -290,8 +426,13 @@ auto Renderer::init_inst(Window* win) -> vkb::Instance {
 		.request_validation_layers()
 		.require_api_version(1, 3, 0)
 		.use_default_debug_messenger();
-	for (const char* ext : win->required_exts) {
-		inst_builder.enable_extension(ext);
+	if (wins.empty()) {
+		inst_builder.set_headless();
+	} else {
+		// the surface extensions do not depend on the window
+		for (const char* ext : wins.front()->required_exts) {
+			inst_builder.enable_extension(ext);
+		}
 	}
 
 	auto vkb_inst_ret = inst_builder.build();
@@ -318,8 +459,11 @@ void Renderer::init_devs(vkb::Instance vkb_inst) {
 		.setSynchronization2(true)
 		.setDynamicRendering(true);
 
-	auto phys_ret = vkb::PhysicalDeviceSelector{vkb_inst}
-		.set_surface(*this->surf)
+	auto selector = vkb::PhysicalDeviceSelector{vkb_inst};
+	if (!this->outputs.empty()) {
+		selector.set_surface(*this->outputs.front().surf);
+	}
+	auto phys_ret = selector
 		.set_minimum_version(1, 3)
 		.set_required_features(required_features)
 		.set_required_features_13(features13)
@@ -329,7 +473,34 @@ void Renderer::init_devs(vkb::Instance vkb_inst) {
 	}
 
 	auto vkb_phys = phys_ret.value();
-	auto dev_ret = vkb::DeviceBuilder{vkb_phys}.build();
+	auto has_mem_budget = vkb_phys.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	// present wait tells when a frame reached the screen, for latency tracking
+	auto present_id = vk::PhysicalDevicePresentIdFeaturesKHR{};
+	auto present_wait = vk::PhysicalDevicePresentWaitFeaturesKHR{};
+	auto has_present_wait = !this->outputs.empty()
+		&& vkb_phys.is_extension_present(VK_KHR_PRESENT_ID_EXTENSION_NAME)
+		&& vkb_phys.is_extension_present(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+	if (has_present_wait) {
+		auto supported = vkb_phys.physical_device.getFeatures2<
+			vk::PhysicalDeviceFeatures2,
+			vk::PhysicalDevicePresentIdFeaturesKHR,
+			vk::PhysicalDevicePresentWaitFeaturesKHR
+		>();
+		has_present_wait = supported.get<vk::PhysicalDevicePresentIdFeaturesKHR>().presentId
+			&& supported.get<vk::PhysicalDevicePresentWaitFeaturesKHR>().presentWait;
+	}
+	if (has_present_wait) {
+		vkb_phys.enable_extension_if_present(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+		vkb_phys.enable_extension_if_present(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+		present_id.setPresentId(true);
+		present_wait.setPresentWait(true);
+	}
+	auto dev_builder = vkb::DeviceBuilder{vkb_phys};
+	if (has_present_wait) {
+		dev_builder.add_pNext(&present_id).add_pNext(&present_wait);
+	}
+	auto dev_ret = dev_builder.build();
 	if (!dev_ret) {
 		throw std::runtime_error(dev_ret.error().message());
 	}
@@ -344,12 +515,31 @@ void Renderer::init_devs(vkb::Instance vkb_inst) {
 	auto queue_fam_ret = vkb_dev.get_queue_index(vkb::QueueType::graphics);
 	if (!queue_fam_ret) throw std::runtime_error("No graphics queue found");
 
+	// only a family without graphics is worth running async work on
+	auto compute_fam_idx = std::optional<u32>{};
+	auto compute_queue_ret = vkb_dev.get_queue(vkb::QueueType::compute);
+	auto compute_fam_ret = vkb_dev.get_queue_index(vkb::QueueType::compute);
+	if (compute_queue_ret && compute_fam_ret && compute_fam_ret.value() != queue_fam_ret.value()) {
+		this->compute_qu = compute_queue_ret.value();
+		compute_fam_idx = compute_fam_ret.value();
+	}
+
 	this->gpu = GPU {
 		.pdev = vkb_phys.physical_device,
 		.props = vkb_phys.properties,
 		.feats = vkb_phys.features,
-		.qu_fam_idx = queue_fam_ret.value()
+		.qu_fam_idx = queue_fam_ret.value(),
+		.has_mem_budget = has_mem_budget,
+		.compute_fam_idx = compute_fam_idx,
+		.has_present_wait = has_present_wait,
 	};
+
+	// the selector only checked the first window, but all are presented from the one queue
+	for (auto& output : this->outputs) {
+		if (!this->gpu.pdev.getSurfaceSupportKHR(this->gpu.qu_fam_idx, *output.surf)) {
+			throw std::runtime_error("graphics queue cannot present to every window");
+		}
+	}
 }
 
 void Renderer::init_sync() {
@@ -368,27 +558,86 @@ void Renderer::init_sync() {
 	auto fence_cinfo = vk::FenceCreateInfo{vk::FenceCreateFlagBits::eSignaled};
 	for (size_t i = 0u; i < cmd_bufs.size(); i++) {
 		this->render_sync[i].cmd = cmd_bufs[i];
-		this->render_sync[i].img_sem = this->dev->createSemaphoreUnique({});
 		this->render_sync[i].drawn = this->dev->createFenceUnique(fence_cinfo);
 	}
+	for (auto& output : this->outputs) {
+		if (!output.swapchain.has_value()) continue;
+		output.img_sems.resize(this->render_sync.size());
+		for (auto& semaphore : output.img_sems) {
+			semaphore = this->dev->createSemaphoreUnique({});
+		}
+	}
+	this->draw_cache.emplace(*this->dev, this->gpu.qu_fam_idx, this->render_sync.size());
+
+	if (this->gpu.compute_fam_idx.has_value()) {
+		this->compute_cmd_pool = this->dev->createCommandPoolUnique(vk::CommandPoolCreateInfo{}
+			.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+			.setQueueFamilyIndex(this->gpu.compute_fam_idx.value())
+		);
+		auto compute_bufs = this->dev->allocateCommandBuffers(vk::CommandBufferAllocateInfo{}
+			.setCommandPool(*this->compute_cmd_pool)
+			.setCommandBufferCount(this->render_sync.size())
+			.setLevel(vk::CommandBufferLevel::ePrimary)
+		);
+		for (usz i = 0u; i < compute_bufs.size(); i++) {
+			this->render_sync[i].compute_cmd = compute_bufs[i];
+			this->render_sync[i].simulated = this->dev->createSemaphoreUnique({});
+		}
+	}
+
+	auto ts_bits = this->gpu.pdev.getQueueFamilyProperties().at(this->gpu.qu_fam_idx).timestampValidBits;
+	if (ts_bits > 0u) {
+		this->timestamp_mask = ts_bits >= 64u ? ~u64{0u} : (u64{1u} << ts_bits) - 1u;
+		this->timestamps = this->dev->createQueryPoolUnique(vk::QueryPoolCreateInfo{}
+			.setQueryType(vk::QueryType::eTimestamp)
+			.setQueryCount(cast<u32>(2u * this->render_sync.size()))
+		);
+	}
 }
 
 void Renderer::init_pipeline() {
-	auto code = read_file("build/triangle.spv");
-	auto module = this->dev->createShaderModuleUnique({
-		{}, code.size(), reinterpret_cast<const u32*>(code.data())
-	});
+	this->layout = create_shader_layout(*this->dev, shaders::triangle);
+	this->init_scene_geometry();
+
+	this->pipeline_fmt = this->color_fmt();
+	this->pipeline = this->build_pipeline(shaders::triangle.spirv, this->pipeline_fmt);
+
+#ifdef VK_SHADER_HOT_RELOAD
+	// the watcher thread only touches the device, the layout and pipeline_fmt,
+	// which are not changed after this point and outlive it
+	this->watcher = std::make_unique<ShaderWatcher>(
+		VK_SHADER_SRC_DIR,
+		VK_SLANGC,
+		[this](const std::string& shader, std::span<const u32> spirv) {
+			// the particle, meshlet and overlay pipelines are owned by their modules
+			if (shader != "triangle") return vk::UniquePipeline{};
+			// the layout comes from the compiled-in reflection and is kept
+			require_matching_interface(shaders::triangle, spirv);
+			return this->build_pipeline(spirv, this->pipeline_fmt);
+		}
+	);
+#endif
+}
+
+// safe to call from any thread, pipeline creation does not need external synchronization
+// entry point names come from reflection and hot-reloaded code is assumed to keep them
+auto Renderer::build_pipeline(
+	std::span<const u32> spirv,
+	vk::Format color_fmt
+) const -> vk::UniquePipeline {
+	auto module = this->dev->createShaderModuleUnique(vk::ShaderModuleCreateInfo{}
+		.setCodeSize(spirv.size_bytes())
+		.setPCode(spirv.data())
+	);
 
-	auto vert_stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *module, "vertexMain");
-	auto frag_stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *module, "fragmentMain");
+	constexpr auto vert_main = shaders::triangle.entry_point(vk::ShaderStageFlagBits::eVertex);
+	constexpr auto frag_main = shaders::triangle.entry_point(vk::ShaderStageFlagBits::eFragment);
+	auto vert_stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *module, vert_main);
+	auto frag_stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *module, frag_main);
 	auto shader_stages = std::array{vert_stage, frag_stage};
 
-	// vertices hardcoded in shader for now
-	auto binding_desc = Vertex::get_binding();
-	auto attr_descs = Vertex::get_attr_descs();
-	auto vertex_input = vk::PipelineVertexInputStateCreateInfo{}
-		.setVertexBindingDescriptions(binding_desc)
-		.setVertexAttributeDescriptions(attr_descs);
+	// the vertex shader reads the scene geometry from storage buffers by index
+	auto vertex_input = vk::PipelineVertexInputStateCreateInfo{};
 
 	auto input_assembly = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList);
 
@@ -414,16 +663,11 @@ void Renderer::init_pipeline() {
 
 	auto color_blend = vk::PipelineColorBlendStateCreateInfo{}.setAttachments(color_blend_attachment);
 
-	auto layout_info = vk::PipelineLayoutCreateInfo{};
-	this->pipeline_layout = this->dev->createPipelineLayoutUnique(layout_info);
-
 	auto dynamic_states = std::array{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
 	auto dynamic_info = vk::PipelineDynamicStateCreateInfo{}.setDynamicStates(dynamic_states);
 
-	auto swap_format = this->swapchain->cinfo.imageFormat;
-
 	auto pipeline_rendering_info = vk::PipelineRenderingCreateInfo{}
-		.setColorAttachmentFormats(swap_format);
+		.setColorAttachmentFormats(color_fmt);
 	// .setDepthAttachmentFormat(...) // If you had a depth buffer
 
 	auto pipeline_info = vk::GraphicsPipelineCreateInfo{}
@@ -436,66 +680,407 @@ void Renderer::init_pipeline() {
 		.setPMultisampleState(&multisample)
 		.setPColorBlendState(&color_blend)
 		.setPDynamicState(&dynamic_info)
-		.setLayout(*this->pipeline_layout)
+		.setLayout(*this->layout.pipeline_layout)
 		.setRenderPass(nullptr);
 
 	auto result = this->dev->createGraphicsPipelineUnique(nullptr, pipeline_info);
 	if (result.result != vk::Result::eSuccess) {
 		throw std::runtime_error("Failed to create pipeline");
 	}
-	this->pipeline = std::move(result.value);
+	return std::move(result.value);
+}
+
+void Renderer::init_scene_geometry() {
+	auto& scene = this->scene;
+	auto storage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+	scene.pos = this->alloc.create_buffer(PoolKind::Geometry, sizeof(SCENE_POS), storage);
+	scene.color = this->alloc.create_buffer(PoolKind::Geometry, sizeof(SCENE_COLOR), storage);
+
+	// copied into the device-local buffers by the first frame
+	scene.staging = this->alloc.create_buffer(
+		PoolKind::Staging,
+		sizeof(SCENE_POS) + sizeof(SCENE_COLOR),
+		vk::BufferUsageFlagBits::eTransferSrc
+	);
+	auto dst = static_cast<std::byte*>(scene.staging->mapped);
+	std::memcpy(dst, SCENE_POS.data(), sizeof(SCENE_POS));
+	std::memcpy(dst + sizeof(SCENE_POS), SCENE_COLOR.data(), sizeof(SCENE_COLOR));
+	this->alloc.flush(scene.staging, 0u, scene.staging->size);
+
+	// one live set, plus the ones replaced within the last frames in flight
+	auto sets = cast<u32>(this->render_sync.size() + 1u);
+	auto pool_size = vk::DescriptorPoolSize{}
+		.setType(vk::DescriptorType::eStorageBuffer)
+		.setDescriptorCount(sets * cast<u32>(shaders::triangle.bindings.size()));
+	scene.descriptor_pool = this->dev->createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{}
+		.setFlags(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet)
+		.setMaxSets(sets)
+		.setPoolSizes(pool_size)
+	);
+}
+
+// must run after the fence of this frame's slot has been waited on, before anything is drawn
+void Renderer::update_scene_geometry(vk::CommandBuffer cmd) {
+	auto& scene = this->scene;
+	auto frames_in_flight = static_cast<u64>(this->render_sync.size());
+	if (!scene.uploaded) {
+		cmd.copyBuffer(scene.staging->buf, scene.pos->buf, vk::BufferCopy{0u, 0u, scene.pos->size});
+		cmd.copyBuffer(scene.staging->buf, scene.color->buf, vk::BufferCopy{scene.pos->size, 0u, scene.color->size});
+		auto barrier = vk::MemoryBarrier2{}
+			.setSrcStageMask(vk::PipelineStageFlagBits2::eCopy)
+			.setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+			.setDstStageMask(vk::PipelineStageFlagBits2::eVertexShader)
+			.setDstAccessMask(vk::AccessFlagBits2::eShaderStorageRead);
+		cmd.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(barrier));
+		scene.uploaded = true;
+		scene.upload_frame = this->img_idx;
+	} else if (scene.staging != nullptr && this->img_idx >= scene.upload_frame + frames_in_flight) {
+		this->alloc.destroy_buffer(scene.staging);
+		scene.staging = nullptr;
+	}
+
+	std::erase_if(scene.retired_sets, [&](const auto& retired) {
+		if (this->img_idx < retired.first + frames_in_flight) return false;
+		this->dev->freeDescriptorSets(*scene.descriptor_pool, retired.second);
+		return true;
+	});
+
+	// defragmentation replaces the buffer handles, the set is then replaced too since
+	// frames in flight and cached groups may still use the old one
+	auto bufs = std::array{scene.pos->buf, scene.color->buf};
+	if (scene.set && bufs == scene.set_bufs) return;
+	if (scene.set) {
+		scene.retired_sets.emplace_back(this->img_idx, scene.set);
+		this->draw_cache->invalidate();
+	}
+
+	auto set_layout = *this->layout.set_layouts.at(0);
+	scene.set = this->dev->allocateDescriptorSets(vk::DescriptorSetAllocateInfo{}
+		.setDescriptorPool(*scene.descriptor_pool)
+		.setSetLayouts(set_layout)
+	).front();
+	scene.set_bufs = bufs;
+
+	auto pos = vk::DescriptorBufferInfo{scene.pos->buf, 0u, vk::WholeSize};
+	auto color = vk::DescriptorBufferInfo{scene.color->buf, 0u, vk::WholeSize};
+	auto write = [&](const ShaderBinding& binding, const vk::DescriptorBufferInfo& info) {
+		return vk::WriteDescriptorSet{}
+			.setDstSet(scene.set)
+			.setDstBinding(binding.binding)
+			.setDescriptorType(binding.type)
+			.setBufferInfo(info);
+	};
+	auto writes = std::array{
+		write(shaders::triangle.binding("inPos"), pos),
+		write(shaders::triangle.binding("inColor"), color),
+	};
+	this->dev->updateDescriptorSets(writes, {});
+}
+
+// called at a frame boundary, after this frame's fence has been waited on
+void Renderer::swap_reloaded_pipelines() {
+#ifdef VK_SHADER_HOT_RELOAD
+	// every frame that could still reference a retired pipeline has been waited on
+	// once this many frames have been started after the swap
+	auto frames_in_flight = static_cast<u64>(this->render_sync.size());
+	std::erase_if(this->retired_pipelines, [&](const auto& retired) {
+		return this->img_idx >= retired.first + frames_in_flight;
+	});
+
+	while (auto reloaded = this->watcher->poll()) {
+		if (this->color_fmt() != this->pipeline_fmt) {
+			std::cerr << "color format changed, dropping reloaded " << reloaded->shader << std::endl;
+			continue;
+		}
+		if (reloaded->shader == "triangle") {
+			this->retired_pipelines.emplace_back(this->img_idx, std::move(this->pipeline));
+			this->pipeline = std::move(reloaded->pipeline);
+			// cached groups have the old pipeline bound
+			this->draw_cache->invalidate();
+		}
+	}
+#endif
+}
+
+auto Renderer::color_fmt() const -> vk::Format {
+	auto& first = this->outputs.front();
+	return first.swapchain.has_value() ? first.swapchain->cinfo.imageFormat : OFFSCREEN_FMT;
 }
 
 void Renderer::draw(FramePacket* pkt) {
+	this->draw(std::span<FramePacket* const>(&pkt, 1u));
+}
+
+void Renderer::draw(std::span<FramePacket* const> pkts) {
+	assert(pkts.size() == this->outputs.size());
+	this->poll_presents();
 	auto i = this->img_idx++ % this->render_sync.size();
 	auto sync = &this->render_sync[i];
-	auto img = this->acq_render_target(sync, pkt);
-	if (!img.has_value()) {
+	if (!this->acq_render_targets(i, pkts)) {
 		return;
 	}
 
+	this->read_gpu_time(i);
+	this->swap_reloaded_pipelines();
+	this->draw_cache->begin_frame(this->color_fmt(), this->img_idx);
+	for (auto pkt : pkts) {
+		sort_draw_commands(pkt->commands);
+		for (auto use : pkt->textures) {
+			this->texture_streamer->mark_used(use.tex, use.screen_px);
+		}
+	}
+
+	auto record_start = std::chrono::steady_clock::now();
 	sync->cmd.reset();
 
 	auto info = vk::CommandBufferBeginInfo{}
 		.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
 	sync->cmd.begin(info);
 
-	this->transition_for_render(sync->cmd);
-	this->render(img.value(), sync->cmd, pkt);
-	this->transition_for_present(sync->cmd);
+	auto first_query = cast<u32>(2u * i);
+	if (this->timestamps) {
+		sync->cmd.resetQueryPool(*this->timestamps, first_query, 2u);
+		sync->cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe, *this->timestamps, first_query);
+	}
+
+	this->manage_memory(i, sync->cmd);
+	this->update_scene_geometry(sync->cmd);
+	this->texture_streamer->update(sync->cmd, i, this->img_idx);
+	if (this->particles.has_value()) {
+		// one step per frame, drawn into every output
+		if (this->compute_qu) {
+			this->simulate_async(sync, i, pkts.front()->dt);
+		} else {
+			this->particles->simulate(sync->cmd, i, pkts.front()->dt, true);
+		}
+	}
+	if (this->meshlets.has_value()) {
+		this->meshlets->begin_frame(sync->cmd, i, this->img_idx, pkts.front()->dt);
+	}
+	if (this->latency_overlay.has_value()) {
+		this->latency_overlay->update(sync->cmd, i, this->latency_tracker);
+	}
+	for (usz j = 0u; j < this->outputs.size(); j++) {
+		if (this->outputs[j].target.has_value()) {
+			this->record_output(this->outputs[j], sync->cmd, pkts[j]);
+		}
+	}
+
+	if (this->timestamps) {
+		sync->cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eBottomOfPipe, *this->timestamps, first_query + 1u);
+		sync->timed = true;
+	}
 
 	sync->cmd.end();
+	this->record_ns = static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - record_start
+	).count());
+
+	// main builds every packet at once, so the first one's stamps stand for all
+	this->submit_and_present(sync, i, pkts.front()->stamps);
+}
+
+// false when no output has an image this frame, the slot's fence is then left signalled
+auto Renderer::acq_render_targets(usz sync_idx, std::span<FramePacket* const> pkts) -> bool {
+	auto sync = &this->render_sync[sync_idx];
+	auto res = this->dev->waitForFences(1, &sync->drawn.get(), true, 1'000'000'000);
+	require_success(res, "wait for fence failed");
 
-	this->submit_and_present(sync);
+	// an output that is being resized sits this frame out, the others still draw
+	auto acquired = false;
+	for (usz i = 0u; i < this->outputs.size(); i++) {
+		auto& output = this->outputs[i];
+		output.target = this->acq_render_target(output, sync_idx, pkts[i]);
+		acquired |= output.target.has_value();
+	}
+	if (!acquired) {
+		return false;
+	}
+
+	// images acquired, now it is safe to reset the fence
+	res = this->dev->resetFences(1, &sync->drawn.get());
+	require_success(res, "reset fence failed");
+	return true;
 }
 
 auto Renderer::acq_render_target(
-	RenderSync* sync,
+	Output& output,
+	usz sync_idx,
 	FramePacket* pkt
 ) -> std::optional<RenderTarget> {
-	auto res = this->dev->waitForFences(1, &sync->drawn.get(), true, 1'000'000'000);
-	require_success(res, "wait for fence failed");
+	if (!output.swapchain.has_value()) {
+		return this->acq_offscreen(output, pkt->drawable_sz);
+	}
 
-	auto img = this->swapchain->acq_next_img(sync->img_sem.get());
+	auto img = output.stale
+		? std::optional<RenderTarget>{}
+		: output.swapchain->acq_next_img(output.img_sems[sync_idx].get());
 	if (!img.has_value()) {
-		if (!this->swapchain->recreate(pkt->drawable_sz)) {
+		this->drop_pending_presents(output);
+		if (!output.swapchain->recreate(pkt->drawable_sz)) {
 			throw std::runtime_error("failed to recreate swapchain");
 		}
+		output.stale = false;
 		return {};
 	}
+	return img;
+}
 
-	// image acquired, now it is safe to reset the fence
-	res = this->dev->resetFences(1, &sync->drawn.get());
-	require_success(res, "reset fence failed");
+auto Renderer::acq_offscreen(Output& output, glm::ivec2 sz) -> RenderTarget {
+	auto extent = vk::Extent2D{cast<u32>(std::max(sz.x, 1)), cast<u32>(std::max(sz.y, 1))};
+	if (!output.offscreen.has_value() || output.offscreen->img->extent != vk::Extent3D{extent, 1u}) {
+		// same as swapchain recreation, resizes are rare enough to just wait
+		this->dev->waitIdle();
+		this->destroy_color_target(output.offscreen);
+		output.offscreen = this->create_color_target(extent,
+			vk::ImageUsageFlagBits::eColorAttachment
+				| vk::ImageUsageFlagBits::eTransferSrc
+				| vk::ImageUsageFlagBits::eTransferDst
+		);
+	}
 
-	return img;
+	return RenderTarget {
+		.img = output.offscreen->img->img,
+		.img_view = *output.offscreen->view,
+		.extent = extent,
+		.img_idx = 0u,
+	};
+}
+
+// the image is sized for the output so scale changes never reallocate,
+// only the top left corner covered by the current scale is rendered
+auto Renderer::acq_scene_target(Output& output, vk::Extent2D extent) -> RenderTarget {
+	if (!output.scene.has_value() || output.scene->img->extent != vk::Extent3D{extent, 1u}) {
+		this->dev->waitIdle();
+		this->destroy_color_target(output.scene);
+		output.scene = this->create_color_target(extent,
+			vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc
+		);
+	}
+
+	return RenderTarget {
+		.img = output.scene->img->img,
+		.img_view = *output.scene->view,
+		.extent = this->dynres->extent(extent),
+		.img_idx = 0u,
+	};
+}
+
+auto Renderer::create_color_target(vk::Extent2D extent, vk::ImageUsageFlags usage) -> Offscreen {
+	auto fmt = this->color_fmt();
+	auto img = this->alloc.create_render_target(vk::ImageCreateInfo{}
+		.setImageType(vk::ImageType::e2D)
+		.setFormat(fmt)
+		.setExtent(vk::Extent3D{extent, 1u})
+		.setMipLevels(1u)
+		.setArrayLayers(1u)
+		.setSamples(vk::SampleCountFlagBits::e1)
+		.setTiling(vk::ImageTiling::eOptimal)
+		.setUsage(usage)
+	);
+	auto view = this->dev->createImageViewUnique(vk::ImageViewCreateInfo{}
+		.setImage(img->img)
+		.setViewType(vk::ImageViewType::e2D)
+		.setFormat(fmt)
+		.setSubresourceRange(SUBRESOURCE_RANGE)
+	);
+	return Offscreen{ .img = img, .view = std::move(view) };
+}
+
+// the caller makes sure the GPU is done with the image
+void Renderer::destroy_color_target(std::optional<Offscreen>& target) {
+	if (!target.has_value()) return;
+	target->view.reset();
+	this->alloc.destroy_image(target->img);
+	target.reset();
+}
+
+// must run after the fence of sync_idx has been waited on
+void Renderer::read_gpu_time(usz sync_idx) {
+	auto sync = &this->render_sync[sync_idx];
+	if (!this->timestamps || !sync->timed) return;
+
+	auto ticks = std::array<u64, 2>{};
+	auto res = this->dev->getQueryPoolResults(
+		*this->timestamps,
+		cast<u32>(2u * sync_idx),
+		2u,
+		sizeof(ticks),
+		ticks.data(),
+		sizeof(u64),
+		vk::QueryResultFlagBits::e64
+	);
+	if (res != vk::Result::eSuccess) return;
+	sync->timed = false;
+
+	auto elapsed = (ticks[1] - ticks[0]) & this->timestamp_mask;
+	auto ns = static_cast<dbl>(elapsed) * static_cast<dbl>(this->gpu.props.limits.timestampPeriod);
+	this->gpu_ns = static_cast<u64>(ns);
+	if (this->dynres.has_value()) {
+		this->dynres->update(static_cast<flt>(ns / 1e6));
+	}
+}
+
+// submitted ahead of the frame's graphics work, which waits for it before drawing
+void Renderer::simulate_async(RenderSync* sync, usz sync_idx, flt dt) {
+	sync->compute_cmd.reset();
+	sync->compute_cmd.begin(vk::CommandBufferBeginInfo{}.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	this->particles->simulate(sync->compute_cmd, sync_idx, dt, false);
+	sync->compute_cmd.end();
+
+	auto cmd_info = vk::CommandBufferSubmitInfo{sync->compute_cmd};
+	auto sig_info = vk::SemaphoreSubmitInfo{}
+		.setSemaphore(sync->simulated.get())
+		.setStageMask(vk::PipelineStageFlagBits2::eComputeShader);
+	auto submit_info = vk::SubmitInfo2{}
+		.setCommandBufferInfos(cmd_info)
+		.setSignalSemaphoreInfos(sig_info);
+	auto res = this->compute_qu.submit2(1, &submit_info, {}, VULKAN_HPP_DEFAULT_DISPATCHER);
+	require_success(res, "failed to submit to compute queue");
+}
+
+// must run after the fence of sync_idx has been waited on
+void Renderer::manage_memory(usz sync_idx, vk::CommandBuffer cmd) {
+	this->alloc.set_frame_idx(static_cast<u32>(this->img_idx));
+
+	if (this->defrag_slot == sync_idx) {
+		this->alloc.finish_defrag_pass();
+		this->defrag_slot.reset();
+	}
+
+	if (this->img_idx % PRESSURE_CHECK_INTERVAL == 0u && !this->alloc.defrag_active()) {
+		auto pressure = this->alloc.heap_pressure();
+		if (pressure > DEFRAG_PRESSURE) {
+			std::cerr << "heap pressure at " << pressure * 100.0f << "%, defragmenting geometry" << std::endl;
+			this->alloc.print_budgets(std::cerr);
+			this->alloc.begin_defrag(PoolKind::Geometry);
+		}
+	}
+
+	if (!this->defrag_slot.has_value() && this->alloc.defrag_active()) {
+		this->alloc.record_defrag_pass(cmd);
+		if (this->alloc.defrag_active()) {
+			this->defrag_slot = sync_idx;
+		}
+	}
 }
 
-void Renderer::transition_for_render(vk::CommandBuffer cmd) const {
-	auto draw_barrier = this->swapchain->base_barrier()
-		.setSrcStageMask(vk::PipelineStageFlagBits2::eTopOfPipe)
+auto Renderer::target_barrier(const RenderTarget& img) const -> vk::ImageMemoryBarrier2 {
+	return vk::ImageMemoryBarrier2{}
+		.setImage(img.img)
+		.setSubresourceRange(SUBRESOURCE_RANGE)
+		.setSrcQueueFamilyIndex(this->gpu.qu_fam_idx)
+		.setDstQueueFamilyIndex(this->gpu.qu_fam_idx);
+}
+
+void Renderer::transition_for_render(const RenderTarget& img, vk::CommandBuffer cmd) const {
+	// offscreen and scene images are reused every frame, so wait for the previous
+	// frame's writes and for its upscale to have read the scene
+	// (for swapchain images this chains with the acquire semaphore wait)
+	auto draw_barrier = this->target_barrier(img)
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput | vk::PipelineStageFlagBits2::eBlit)
 		.setDstStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput)
-		.setSrcAccessMask(vk::AccessFlagBits2::eNone)
+		.setSrcAccessMask(vk::AccessFlagBits2::eColorAttachmentWrite)
 		.setDstAccessMask(vk::AccessFlagBits2::eColorAttachmentWrite)
 		.setOldLayout(vk::ImageLayout::eUndefined)
 		.setNewLayout(vk::ImageLayout::eColorAttachmentOptimal);
@@ -503,66 +1088,202 @@ void Renderer::transition_for_render(vk::CommandBuffer cmd) const {
 	cmd.pipelineBarrier2(dep_info);
 }
 
+// renders the packet into the output's acquired image and leaves it ready for presenting
+void Renderer::record_output(Output& output, vk::CommandBuffer cmd, FramePacket* pkt) {
+	auto& img = output.target.value();
+	if (this->dynres.has_value()) {
+		auto scene = this->acq_scene_target(output, img.extent);
+		this->transition_for_render(scene, cmd);
+		if (this->meshlets.has_value()) {
+			this->meshlets->draw(cmd, scene.img_view, scene.extent);
+		}
+		this->render(scene, cmd, pkt);
+		this->upscale(scene, img, cmd);
+		this->transition_for_present(output, vk::ImageLayout::eTransferDstOptimal, cmd);
+	} else {
+		this->transition_for_render(img, cmd);
+		if (this->meshlets.has_value()) {
+			this->meshlets->draw(cmd, img.img_view, img.extent);
+		}
+		this->render(img, cmd, pkt);
+		this->transition_for_present(output, vk::ImageLayout::eColorAttachmentOptimal, cmd);
+	}
+}
+
 void Renderer::render(RenderTarget& img, vk::CommandBuffer cmd, FramePacket* pkt) {
 	auto color = vk::ClearColorValue{}.setFloat32({0.0, 0.0, 0.0, 1.0});
 	auto attach_info = vk::RenderingAttachmentInfo{}
 		.setImageView(img.img_view)
 		.setImageLayout(vk::ImageLayout::eColorAttachmentOptimal)
 		.setClearValue(color)
-		.setLoadOp(vk::AttachmentLoadOp::eClear)
+		// the meshlets were drawn first and cleared the target themselves
+		.setLoadOp(this->meshlets.has_value() ? vk::AttachmentLoadOp::eLoad : vk::AttachmentLoadOp::eClear)
 		.setStoreOp(vk::AttachmentStoreOp::eStore);
 	auto render_info = vk::RenderingInfo{}
+		.setFlags(vk::RenderingFlagBits::eContentsSecondaryCommandBuffers)
 		.setRenderArea({{0, 0}, img.extent})
 		.setLayerCount(1)
 		.setColorAttachments(attach_info);
+
+	// commands are sorted, so each group is one contiguous range
+	auto record = DrawCache::Recorder([this, extent = img.extent](vk::CommandBuffer secondary, std::span<const DrawCommand> commands) {
+		this->record_draws(secondary, extent, commands);
+	});
+	this->secondaries.clear();
+	auto commands = std::span<const DrawCommand>(pkt->commands);
+	while (!commands.empty()) {
+		auto group = draw_group(commands.front());
+		auto end = std::find_if(commands.begin(), commands.end(), [&](const DrawCommand& draw) {
+			return draw_group(draw) != group;
+		});
+		auto range = commands.first(static_cast<usz>(end - commands.begin()));
+		this->secondaries.push_back(group == 0u
+			? this->draw_cache->transient(range, record)
+			: this->draw_cache->group(range, img.extent, record)
+		);
+		commands = commands.subspan(range.size());
+	}
+	if (this->particles.has_value()) {
+		this->secondaries.push_back(this->draw_cache->transient({}, [this, extent = img.extent](vk::CommandBuffer secondary, std::span<const DrawCommand>) {
+			this->particles->draw(secondary, extent);
+		}));
+	}
+	if (this->latency_overlay.has_value()) {
+		this->secondaries.push_back(this->draw_cache->transient({}, [this, extent = img.extent](vk::CommandBuffer secondary, std::span<const DrawCommand>) {
+			this->latency_overlay->draw(secondary, extent);
+		}));
+	}
+
 	cmd.beginRendering(render_info);
+	if (!this->secondaries.empty()) {
+		cmd.executeCommands(this->secondaries);
+	}
+	cmd.endRendering();
+}
 
+// secondary command buffers start without any state, so set it all
+void Renderer::record_draws(
+	vk::CommandBuffer cmd,
+	vk::Extent2D extent,
+	std::span<const DrawCommand> commands
+) const {
 	cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *this->pipeline);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *this->layout.pipeline_layout, 0u, this->scene.set, {});
 
 	// set dynamic states
 	auto viewport = vk::Viewport{}
 		.setX(0.0f)
 		.setY(0.0f)
-		.setWidth(static_cast<flt>(img.extent.width))
-		.setHeight(static_cast<flt>(img.extent.height))
+		.setWidth(static_cast<flt>(extent.width))
+		.setHeight(static_cast<flt>(extent.height))
 		.setMinDepth(0.0f)
 		.setMaxDepth(1.0f);
 	cmd.setViewport(0, viewport);
 
 	auto scissor = vk::Rect2D{}
 		.setOffset({0, 0})
-		.setExtent(img.extent);
+		.setExtent(extent);
 	cmd.setScissor(0, scissor);
 
-	cmd.draw(3, 1, 0, 0);
+	for (auto& draw : commands) {
+		cmd.draw(draw.vertex_count, draw.instance_count, draw.first_vertex, draw.first_instance);
+	}
+}
+
+// stretches the rendered part of the scene over the whole output image,
+// leaving the output in TransferDstOptimal
+void Renderer::upscale(const RenderTarget& scene, const RenderTarget& img, vk::CommandBuffer cmd) const {
+	auto barriers = std::array{
+		this->target_barrier(scene)
+			.setSrcStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput)
+			.setDstStageMask(vk::PipelineStageFlagBits2::eBlit)
+			.setSrcAccessMask(vk::AccessFlagBits2::eColorAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits2::eTransferRead)
+			.setOldLayout(vk::ImageLayout::eColorAttachmentOptimal)
+			.setNewLayout(vk::ImageLayout::eTransferSrcOptimal),
+		// same reasoning as transition_for_render, the output may be the reused offscreen image
+		this->target_barrier(img)
+			.setSrcStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput | vk::PipelineStageFlagBits2::eBlit)
+			.setDstStageMask(vk::PipelineStageFlagBits2::eBlit)
+			.setSrcAccessMask(vk::AccessFlagBits2::eColorAttachmentWrite | vk::AccessFlagBits2::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits2::eTransferWrite)
+			.setOldLayout(vk::ImageLayout::eUndefined)
+			.setNewLayout(vk::ImageLayout::eTransferDstOptimal),
+	};
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(barriers));
 
-	cmd.endRendering();
+	auto layers = vk::ImageSubresourceLayers{}
+		.setAspectMask(vk::ImageAspectFlagBits::eColor)
+		.setLayerCount(1u);
+	auto corner = [](vk::Extent2D extent) {
+		return vk::Offset3D{cast<i32>(extent.width), cast<i32>(extent.height), 1};
+	};
+	auto region = vk::ImageBlit2{}
+		.setSrcSubresource(layers)
+		.setSrcOffsets({vk::Offset3D{}, corner(scene.extent)})
+		.setDstSubresource(layers)
+		.setDstOffsets({vk::Offset3D{}, corner(img.extent)});
+	cmd.blitImage2(vk::BlitImageInfo2{}
+		.setSrcImage(scene.img)
+		.setSrcImageLayout(vk::ImageLayout::eTransferSrcOptimal)
+		.setDstImage(img.img)
+		.setDstImageLayout(vk::ImageLayout::eTransferDstOptimal)
+		.setRegions(region)
+		.setFilter(vk::Filter::eLinear)
+	);
 }
 
-void Renderer::transition_for_present(vk::CommandBuffer cmd) const {
-	auto present_barrier = this->swapchain->base_barrier()
-		.setSrcStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput)
+void Renderer::transition_for_present(
+	const Output& output,
+	vk::ImageLayout from,
+	vk::CommandBuffer cmd
+) const {
+	// headless frames are left ready for readback
+	auto final_layout = output.swapchain.has_value()
+		? vk::ImageLayout::ePresentSrcKHR
+		: vk::ImageLayout::eTransferSrcOptimal;
+	auto blitted = from == vk::ImageLayout::eTransferDstOptimal;
+	auto present_barrier = this->target_barrier(output.target.value())
+		.setSrcStageMask(blitted ? vk::PipelineStageFlagBits2::eBlit : vk::PipelineStageFlagBits2::eColorAttachmentOutput)
 		.setDstStageMask(vk::PipelineStageFlagBits2::eBottomOfPipe)
-		.setSrcAccessMask(vk::AccessFlagBits2::eColorAttachmentWrite)
+		.setSrcAccessMask(blitted ? vk::AccessFlagBits2::eTransferWrite : vk::AccessFlagBits2::eColorAttachmentWrite)
 		.setDstAccessMask(vk::AccessFlagBits2::eNone)
-		.setOldLayout(vk::ImageLayout::eColorAttachmentOptimal)
-		.setNewLayout(vk::ImageLayout::ePresentSrcKHR);
+		.setOldLayout(from)
+		.setNewLayout(final_layout);
 	auto dep_info = vk::DependencyInfo{}.setImageMemoryBarriers(present_barrier);
 	cmd.pipelineBarrier2(dep_info);
 }
 
-void Renderer::submit_and_present(RenderSync* sync) {
+void Renderer::submit_and_present(RenderSync* sync, usz sync_idx, const FrameTimestamps& stamps) {
+	// the swapchain images are either rendered to or blitted into
+	constexpr auto img_stages = vk::PipelineStageFlagBits2::eColorAttachmentOutput | vk::PipelineStageFlagBits2::eBlit;
+
+	// every acquired image and the async particle step
+	this->submit_waits.clear();
+	this->submit_signals.clear();
+	for (auto& output : this->outputs) {
+		if (!output.swapchain.has_value() || !output.target.has_value()) continue;
+		this->submit_waits.push_back(vk::SemaphoreSubmitInfo{}
+			.setSemaphore(output.img_sems[sync_idx].get())
+			.setStageMask(img_stages)
+		);
+		this->submit_signals.push_back(vk::SemaphoreSubmitInfo{}
+			.setSemaphore(output.swapchain->get_sem())
+			.setStageMask(img_stages)
+		);
+	}
+	if (this->particles.has_value() && this->compute_qu) {
+		this->submit_waits.push_back(vk::SemaphoreSubmitInfo{}
+			.setSemaphore(sync->simulated.get())
+			.setStageMask(ParticleSystem::DRAW_STAGES)
+		);
+	}
+
 	auto cmd_info = vk::CommandBufferSubmitInfo{sync->cmd};
-	auto wait_info = vk::SemaphoreSubmitInfo{}
-		.setSemaphore(sync->img_sem.get())
-		.setStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput);
-	auto sig_info = vk::SemaphoreSubmitInfo{}
-		.setSemaphore(this->swapchain->get_sem())
-		.setStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput);
 	auto submit_info = vk::SubmitInfo2{}
-		.setWaitSemaphoreInfos(wait_info)
+		.setWaitSemaphoreInfos(this->submit_waits)
 		.setCommandBufferInfos(cmd_info)
-		.setSignalSemaphoreInfos(sig_info);
+		.setSignalSemaphoreInfos(this->submit_signals);
 	auto res = this->qu.submit2(
 		1,
 		&submit_info,
@@ -571,5 +1292,94 @@ void Renderer::submit_and_present(RenderSync* sync) {
 	);
 	require_success(res, "failed to submit to queue");
 
-	this->swapchain->present(this->qu);
+	auto submitted = stamps;
+	submitted.submit_ns = steady_ns();
+	this->present(submitted);
+}
+
+// one presentKHR for all swapchains that acquired an image this frame
+void Renderer::present(FrameTimestamps stamps) {
+	this->present_swapchains.clear();
+	this->present_idxs.clear();
+	this->present_sems.clear();
+	this->presented.clear();
+	for (auto& output : this->outputs) {
+		auto target = std::exchange(output.target, std::nullopt);
+		if (!output.swapchain.has_value() || !target.has_value()) continue;
+		auto& swapchain = output.swapchain.value();
+		this->present_swapchains.push_back(*swapchain.inner);
+		this->present_idxs.push_back(swapchain.img_idx.value());
+		this->present_sems.push_back(swapchain.get_sem());
+		this->presented.push_back(&output);
+		swapchain.img_idx.reset();
+	}
+	if (this->presented.empty()) {
+		// headless, nothing to wait for
+		this->latency_tracker.record(stamps);
+		return;
+	}
+
+	// a frame still pending after PENDING_FRAMES more is not going to show up
+	auto slot = this->img_idx % PENDING_FRAMES;
+	auto& pending = this->pending_frames[slot];
+	for (auto& output : this->outputs) {
+		output.present_ids[slot] = 0u;
+	}
+	pending = PendingFrame{ .stamps = stamps, .outstanding = 0u, .dropped = false };
+
+	this->present_results.assign(this->presented.size(), vk::Result::eSuccess);
+	auto present_info = vk::PresentInfoKHR{}
+		.setWaitSemaphores(this->present_sems)
+		.setSwapchains(this->present_swapchains)
+		.setImageIndices(this->present_idxs)
+		.setResults(this->present_results);
+	auto present_ids = vk::PresentIdKHR{};
+	if (this->gpu.has_present_wait) {
+		this->present_id_values.clear();
+		for (auto output : this->presented) {
+			this->present_id_values.push_back(++this->last_present_id);
+			output->present_ids[slot] = this->last_present_id;
+		}
+		present_ids.setPresentIds(this->present_id_values);
+		present_info.setPNext(&present_ids);
+		pending.outstanding = cast<u32>(this->presented.size());
+	}
+
+	// the call fails as a whole if any swapchain does, the results say which one
+	auto res = this->qu.presentKHR(&present_info);
+	if (res != vk::Result::eSuccess && res != vk::Result::eSuboptimalKHR && res != vk::Result::eErrorOutOfDateKHR) {
+		throw std::runtime_error("present failed");
+	}
+
+	// recreated by the next acquisition, with that frame's drawable size
+	for (usz i = 0u; i < this->presented.size(); i++) {
+		this->presented[i]->stale = needs_recreation(this->present_results[i]);
+	}
+
+	if (!this->gpu.has_present_wait) {
+		// the best guess without present wait, the image may take another refresh or more
+		stamps.present_ns = steady_ns();
+		this->latency_tracker.record(stamps);
+		return;
+	}
+	// failed presents never complete their id
+	for (usz i = 0u; i < this->presented.size(); i++) {
+		auto res = this->present_results[i];
+		if (res != vk::Result::eSuccess && res != vk::Result::eSuboptimalKHR) {
+			this->presented[i]->present_ids[slot] = 0u;
+			pending.outstanding--;
+			pending.dropped = true;
+		}
+	}
+}
+
+// the swapchain is about to be replaced, the ids presented to it can no longer be waited on
+void Renderer::drop_pending_presents(Output& output) {
+	for (usz slot = 0u; slot < PENDING_FRAMES; slot++) {
+		auto& id = output.present_ids[slot];
+		if (id == 0u) continue;
+		id = 0u;
+		this->pending_frames[slot].outstanding--;
+		this->pending_frames[slot].dropped = true;
+	}
 }
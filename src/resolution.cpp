@@ -0,0 +1,70 @@
+#include "resolution.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// weight of a new sample in the moving average
+static constexpr flt SMOOTHING = 0.1f;
+// samples ignored after a change, the frames in flight were recorded at the old scale
+static constexpr u32 SETTLE_FRAMES = 4u;
+// scale up only once the average is this far below the target, so the scale
+// does not oscillate around it
+static constexpr flt UPSCALE_BELOW = 0.85f;
+// changes aim this far below the target to leave some headroom
+static constexpr flt AIM = 0.9f;
+static constexpr flt MAX_STEP = 0.1f;
+static constexpr flt MIN_STEP = 0.01f;
+
+ResolutionController::ResolutionController(flt target_ms, flt min_scale, flt max_scale)
+	: target{target_ms}, min_scale{min_scale}, max_scale{max_scale}, cur_scale{max_scale} {
+	assert(target_ms > 0.0f);
+	assert(0.0f < min_scale && min_scale <= max_scale);
+}
+
+auto ResolutionController::update(flt gpu_ms) -> flt {
+	if (this->settle > 0u) {
+		this->settle--;
+		return this->cur_scale;
+	}
+
+	this->avg_ms = this->avg_ms == 0.0f
+		? gpu_ms
+		: this->avg_ms + (gpu_ms - this->avg_ms) * SMOOTHING;
+
+	auto over = this->avg_ms > this->target;
+	auto under = this->avg_ms < this->target * UPSCALE_BELOW;
+	if (!over && !under) {
+		return this->cur_scale;
+	}
+
+	// pixel count goes with the square of the scale
+	auto wanted = this->cur_scale * std::sqrt(this->target * AIM / this->avg_ms);
+	wanted = std::clamp(wanted, this->cur_scale - MAX_STEP, this->cur_scale + MAX_STEP);
+	wanted = std::clamp(wanted, this->min_scale, this->max_scale);
+	if (std::abs(wanted - this->cur_scale) < MIN_STEP) {
+		return this->cur_scale;
+	}
+
+	// predict the new cost instead of waiting for the average to catch up
+	auto ratio = wanted / this->cur_scale;
+	this->avg_ms *= ratio * ratio;
+	this->cur_scale = wanted;
+	this->settle = SETTLE_FRAMES;
+	return this->cur_scale;
+}
+
+auto ResolutionController::scale() const -> flt {
+	return this->cur_scale;
+}
+
+auto ResolutionController::target_ms() const -> flt {
+	return this->target;
+}
+
+auto ResolutionController::extent(vk::Extent2D output) const -> vk::Extent2D {
+	auto scaled = [&](u32 px) {
+		return std::max(1u, static_cast<u32>(std::lround(static_cast<flt>(px) * this->cur_scale)));
+	};
+	return vk::Extent2D{scaled(output.width), scaled(output.height)};
+}
@@ -1,12 +1,55 @@
+#include "shader.hpp"
+
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <ios>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <vulkan/vulkan.hpp>
+
 #include "sugar.hpp"
 
 using namespace std;
 
+// the few SPIR-V opcodes and enums require_matching_interface reads
+constexpr u32 SPV_MAGIC = 0x07230203u;
+constexpr usz SPV_HEADER_WORDS = 5u;
+constexpr u32 SPV_OP_ENTRY_POINT = 15u;
+constexpr u32 SPV_OP_VARIABLE = 59u;
+constexpr u32 SPV_OP_DECORATE = 71u;
+constexpr u32 SPV_DECORATION_BINDING = 33u;
+constexpr u32 SPV_DECORATION_DESCRIPTOR_SET = 34u;
+constexpr u32 SPV_STORAGE_UNIFORM_CONSTANT = 0u;
+constexpr u32 SPV_STORAGE_UNIFORM = 2u;
+constexpr u32 SPV_STORAGE_PUSH_CONSTANT = 9u;
+constexpr u32 SPV_STORAGE_STORAGE_BUFFER = 12u;
+
+static auto spirv_stage(u32 model) -> optional<vk::ShaderStageFlagBits> {
+	switch (model) {
+		case 0u: return vk::ShaderStageFlagBits::eVertex;
+		case 4u: return vk::ShaderStageFlagBits::eFragment;
+		case 5u: return vk::ShaderStageFlagBits::eCompute;
+		case 5364u: return vk::ShaderStageFlagBits::eTaskEXT;
+		case 5365u: return vk::ShaderStageFlagBits::eMeshEXT;
+	}
+	return {};
+}
+
+static auto storage_fits(u32 storage, vk::DescriptorType type) -> bool {
+	auto buffer = type == vk::DescriptorType::eUniformBuffer || type == vk::DescriptorType::eStorageBuffer;
+	switch (storage) {
+		case SPV_STORAGE_STORAGE_BUFFER: return type == vk::DescriptorType::eStorageBuffer;
+		// storage buffers are Uniform with BufferBlock before SPIR-V 1.3
+		case SPV_STORAGE_UNIFORM: return buffer;
+		case SPV_STORAGE_UNIFORM_CONSTANT: return !buffer;
+	}
+	return false;
+}
+
 auto read_file(string name) -> vector<char> {
 	auto f = ifstream(name, ios::ate | ios::binary);
 	if (!f.is_open()) throw std::runtime_error("failed to open file!");
@@ -18,3 +61,129 @@ auto read_file(string name) -> vector<char> {
 
 	return buf;
 }
+
+auto create_shader_layout(
+	vk::Device dev,
+	vk::ShaderStageFlags stages,
+	std::span<const ShaderBinding> bindings,
+	std::span<const ShaderPushConstant> push_constants
+) -> ShaderLayout {
+	u32 set_count = 0u;
+	for (auto& b : bindings) {
+		set_count = std::max(set_count, b.set + 1u);
+	}
+
+	// sets with no bindings still need a (empty) layout so the indices line up
+	auto set_bindings = vector<vector<vk::DescriptorSetLayoutBinding>>(set_count);
+	for (auto& b : bindings) {
+		set_bindings[b.set].push_back(vk::DescriptorSetLayoutBinding{}
+			.setBinding(b.binding)
+			.setDescriptorType(b.type)
+			.setDescriptorCount(b.count)
+			.setStageFlags(stages)
+		);
+	}
+
+	auto ret = ShaderLayout{};
+	auto raw_set_layouts = vector<vk::DescriptorSetLayout>{};
+	for (auto& set : set_bindings) {
+		auto cinfo = vk::DescriptorSetLayoutCreateInfo{}.setBindings(set);
+		ret.set_layouts.push_back(dev.createDescriptorSetLayoutUnique(cinfo));
+		raw_set_layouts.push_back(*ret.set_layouts.back());
+	}
+
+	// every block is visible to every stage of the module, and ranges sharing a
+	// stage must not overlap, so they are merged into one
+	auto ranges = vector<vk::PushConstantRange>{};
+	if (!push_constants.empty()) {
+		auto begin = push_constants.front().offset;
+		auto end = push_constants.front().offset + push_constants.front().size;
+		for (auto& pc : push_constants) {
+			begin = std::min(begin, pc.offset);
+			end = std::max(end, pc.offset + pc.size);
+		}
+		ranges.push_back(vk::PushConstantRange{}
+			.setStageFlags(stages)
+			.setOffset(begin)
+			.setSize(end - begin)
+		);
+	}
+
+	auto layout_info = vk::PipelineLayoutCreateInfo{}
+		.setSetLayouts(raw_set_layouts)
+		.setPushConstantRanges(ranges);
+	ret.pipeline_layout = dev.createPipelineLayoutUnique(layout_info);
+
+	return ret;
+}
+
+void require_matching_interface(
+	std::span<const u32> spirv,
+	std::span<const ShaderEntryPoint> entry_points,
+	std::span<const ShaderBinding> bindings,
+	std::span<const ShaderPushConstant> push_constants
+) {
+	if (spirv.size() < SPV_HEADER_WORDS || spirv[0] != SPV_MAGIC) {
+		throw std::runtime_error("not a SPIR-V module");
+	}
+
+	struct Variable {
+		u32 storage = ~0u;
+		u32 set = ~0u;
+		u32 binding = ~0u;
+	};
+	auto vars = unordered_map<u32, Variable>{};
+	auto entries = vector<pair<string, vk::ShaderStageFlagBits>>{};
+	for (auto i = SPV_HEADER_WORDS; i < spirv.size();) {
+		auto words = spirv[i] >> 16u;
+		auto op = spirv[i] & 0xffffu;
+		if (words == 0u || i + words > spirv.size()) {
+			throw std::runtime_error("malformed SPIR-V module");
+		}
+		auto ins = spirv.subspan(i, words);
+		i += words;
+		if (words < 4u) continue;
+
+		if (op == SPV_OP_ENTRY_POINT) {
+			// nul terminated string packed into the words after the function id
+			auto chars = reinterpret_cast<const char*>(&ins[3]);
+			auto name = string(chars, strnlen(chars, (words - 3u) * sizeof(u32)));
+			if (auto stage = spirv_stage(ins[1])) {
+				entries.emplace_back(std::move(name), *stage);
+			}
+		} else if (op == SPV_OP_VARIABLE) {
+			vars[ins[2]].storage = ins[3];
+		} else if (op == SPV_OP_DECORATE && ins[2] == SPV_DECORATION_DESCRIPTOR_SET) {
+			vars[ins[1]].set = ins[3];
+		} else if (op == SPV_OP_DECORATE && ins[2] == SPV_DECORATION_BINDING) {
+			vars[ins[1]].binding = ins[3];
+		}
+	}
+
+	for (auto& ep : entry_points) {
+		auto found = std::any_of(entries.begin(), entries.end(), [&](const auto& e) {
+			return e.first == ep.name && e.second == ep.stage;
+		});
+		if (!found) {
+			throw std::runtime_error("entry point " + string(ep.name) + " is gone");
+		}
+	}
+
+	for (auto& [id, var] : vars) {
+		if (var.storage == SPV_STORAGE_PUSH_CONSTANT && push_constants.empty()) {
+			throw std::runtime_error("push constants were added");
+		}
+		if (var.set == ~0u || var.binding == ~0u) continue;
+
+		auto where = "set " + to_string(var.set) + " binding " + to_string(var.binding);
+		auto it = std::find_if(bindings.begin(), bindings.end(), [&](const ShaderBinding& b) {
+			return b.set == var.set && b.binding == var.binding;
+		});
+		if (it == bindings.end()) {
+			throw std::runtime_error(where + " is not in the pipeline layout");
+		}
+		if (!storage_fits(var.storage, it->type)) {
+			throw std::runtime_error(where + " changed its descriptor type");
+		}
+	}
+}
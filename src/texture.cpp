@@ -0,0 +1,541 @@
+#include "texture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include <vulkan/vulkan_format_traits.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sugar.hpp"
+#include "vma.hpp"
+
+constexpr auto TEX_MAGIC = std::array{'V', 'K', 'T', 'X'};
+constexpr u32 TEX_VERSION = 1u;
+
+// mips up to this size make up the tail that stays resident for every loaded texture
+constexpr u32 TAIL_SIZE = 64u;
+// textures not used for this many frames fall back to their tail when space is needed
+constexpr u64 UNUSED_FRAMES = 120u;
+// size of each frame's staging buffer, larger levels are uploaded over several frames
+constexpr u64 UPLOAD_BYTES_PER_FRAME = 16u * 1024u * 1024u;
+// stages that may sample a streamed texture
+constexpr auto SAMPLING_STAGES = vk::PipelineStageFlagBits2::eVertexShader
+	| vk::PipelineStageFlagBits2::eFragmentShader
+	| vk::PipelineStageFlagBits2::eComputeShader;
+
+static constexpr auto align_up(u64 value, u64 align) -> u64 {
+	return (value + align - 1u) / align * align;
+}
+
+void write_texture_container(const std::string& path, vk::Format fmt, std::span<const TexMipData> mips) {
+	if (mips.empty()) throw std::runtime_error("texture has no mips");
+
+	auto header = TexHeader {
+		.magic = TEX_MAGIC,
+		.version = TEX_VERSION,
+		.format = static_cast<u32>(fmt),
+		.width = mips.front().width,
+		.height = mips.front().height,
+		.mip_count = cast<u32>(mips.size()),
+	};
+
+	// coarsest first
+	auto table = std::vector<TexMip>{};
+	auto ofs = align_up(sizeof(TexHeader) + sizeof(TexMip) * mips.size(), TEX_DATA_ALIGN);
+	for (auto it = mips.rbegin(); it != mips.rend(); it++) {
+		table.push_back(TexMip {
+			.offset = ofs,
+			.size = it->data.size(),
+			.width = it->width,
+			.height = it->height,
+		});
+		ofs = align_up(ofs + it->data.size(), TEX_DATA_ALIGN);
+	}
+
+	auto out = std::ofstream(path, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) throw std::runtime_error("failed to open texture for writing");
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(table.data()), sizeof(TexMip) * table.size());
+
+	auto pos = static_cast<u64>(out.tellp());
+	auto padding = std::array<char, TEX_DATA_ALIGN>{};
+	for (usz i = 0u; i < table.size(); i++) {
+		auto& data = mips[mips.size() - 1u - i].data;
+		out.write(padding.data(), static_cast<std::streamsize>(table[i].offset - pos));
+		out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		pos = table[i].offset + data.size();
+	}
+	if (!out) throw std::runtime_error("failed to write texture");
+}
+
+MappedFile::MappedFile(const std::string& path) {
+	auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) throw std::runtime_error("failed to open " + path);
+
+	struct stat st{};
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		throw std::runtime_error("failed to stat " + path);
+	}
+	this->size = static_cast<usz>(st.st_size);
+
+	auto ptr = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) throw std::runtime_error("failed to map " + path);
+	this->ptr = static_cast<std::byte*>(ptr);
+}
+
+MappedFile::~MappedFile() {
+	if (this->ptr != nullptr) {
+		munmap(this->ptr, this->size);
+	}
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+	: ptr{std::exchange(other.ptr, nullptr)}, size{std::exchange(other.size, 0u)} {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		if (this->ptr != nullptr) {
+			munmap(this->ptr, this->size);
+		}
+		this->ptr = std::exchange(other.ptr, nullptr);
+		this->size = std::exchange(other.size, 0u);
+	}
+	return *this;
+}
+
+auto MappedFile::bytes() const -> std::span<const std::byte> {
+	return {this->ptr, this->size};
+}
+
+TextureStreamer::TextureStreamer(
+	vk::Device dev,
+	VulkanAllocator* alloc,
+	u64 budget,
+	usz frames_in_flight
+) : dev{dev}, alloc{alloc}, budget{budget}, frames_in_flight{frames_in_flight} {
+	this->staging.resize(frames_in_flight, nullptr);
+}
+
+TextureStreamer::~TextureStreamer() {
+	for (auto& r : this->retired) {
+		r.view.reset();
+		this->alloc->destroy_image(r.img);
+	}
+	for (auto& tex : this->textures) {
+		tex.view.reset();
+		if (tex.img != nullptr) {
+			this->alloc->destroy_image(tex.img);
+		}
+		if (tex.next != nullptr) {
+			this->alloc->destroy_image(tex.next);
+		}
+	}
+	for (auto buf : this->staging) {
+		if (buf != nullptr) {
+			this->alloc->destroy_buffer(buf);
+		}
+	}
+}
+
+auto TextureStreamer::load(const std::string& path) -> TextureHandle {
+	auto file = MappedFile(path);
+	auto bytes = file.bytes();
+	if (bytes.size() < sizeof(TexHeader)) throw std::runtime_error("not a texture: " + path);
+
+	auto header = reinterpret_cast<const TexHeader*>(bytes.data());
+	if (header->magic != TEX_MAGIC || header->version != TEX_VERSION || header->mip_count == 0u) {
+		throw std::runtime_error("not a texture: " + path);
+	}
+	if (bytes.size() < sizeof(TexHeader) + sizeof(TexMip) * header->mip_count) {
+		throw std::runtime_error("truncated texture: " + path);
+	}
+	auto mips = std::span<const TexMip>(
+		reinterpret_cast<const TexMip*>(bytes.data() + sizeof(TexHeader)),
+		header->mip_count
+	);
+	for (auto& mip : mips) {
+		if (mip.offset + mip.size > bytes.size()) throw std::runtime_error("truncated texture: " + path);
+	}
+
+	auto tex = Texture {
+		.file = std::move(file),
+		.header = header,
+		.mips = mips,
+		.tail = 0u,
+		.resident = header->mip_count,
+		.wanted = header->mip_count - 1u,
+	};
+	for (u32 lvl = 0u; lvl < header->mip_count; lvl++) {
+		auto& mip = this->level(tex, lvl);
+		if (std::max(mip.width, mip.height) <= TAIL_SIZE) {
+			tex.tail = lvl;
+			break;
+		}
+	}
+	tex.wanted = tex.tail;
+
+	// levels are uploaded in rows of blocks, at least one of which has to fit a frame's staging buffer
+	for (u32 lvl = 0u; lvl < header->mip_count; lvl++) {
+		auto& mip = this->level(tex, lvl);
+		auto rows = this->block_rows(tex, lvl);
+		if (rows == 0u || mip.size == 0u || mip.size % rows != 0u || mip.size / rows > UPLOAD_BYTES_PER_FRAME) {
+			throw std::runtime_error("texture mips are not tightly packed blocks: " + path);
+		}
+	}
+
+	this->textures.push_back(std::move(tex));
+	return cast<TextureHandle>(this->textures.size() - 1u);
+}
+
+void TextureStreamer::mark_used(TextureHandle handle, flt screen_px) {
+	auto& tex = this->textures.at(handle);
+	auto ratio = static_cast<flt>(std::max(tex.header->width, tex.header->height)) / std::max(screen_px, 1.0f);
+	auto lvl = static_cast<u32>(std::clamp(std::floor(std::log2(std::max(ratio, 1.0f))), 0.0f, static_cast<flt>(tex.tail)));
+	tex.marked = std::min(tex.marked.value_or(lvl), lvl);
+}
+
+void TextureStreamer::update(vk::CommandBuffer cmd, usz sync_idx, u64 frame) {
+	auto kept = usz{0u};
+	for (usz i = 0u; i < this->retired.size(); i++) {
+		auto& r = this->retired[i];
+		if (frame < r.frame + this->frames_in_flight) {
+			if (kept != i) {
+				this->retired[kept] = std::move(r);
+			}
+			kept++;
+			continue;
+		}
+		r.view.reset();
+		this->alloc->destroy_image(r.img);
+	}
+	this->retired.erase(this->retired.begin() + static_cast<isz>(kept), this->retired.end());
+
+	// this slot's fence has been waited on, so its staging buffer is free to reuse
+	auto& staging = this->staging[sync_idx];
+	if (staging == nullptr) {
+		staging = this->alloc->create_buffer(PoolKind::Staging, UPLOAD_BYTES_PER_FRAME, vk::BufferUsageFlagBits::eTransferSrc);
+	}
+	auto staging_ofs = u64{0u};
+	auto staging_full = false;
+
+	// uses marked since the last update belong to this frame
+	for (auto& tex : this->textures) {
+		if (tex.marked.has_value()) {
+			tex.wanted = *tex.marked;
+			tex.last_used = frame;
+			tex.marked.reset();
+		}
+	}
+	auto desired = [&](const Texture& tex) -> u32 {
+		auto recent = tex.last_used <= frame && frame - tex.last_used <= UNUSED_FRAMES;
+		return recent ? std::min(tex.wanted, tex.tail) : tex.tail;
+	};
+
+	// drop detail nobody needs any more, that only copies between images
+	for (auto& tex : this->textures) {
+		auto want = desired(tex);
+		if (tex.next != nullptr && tex.next_lvl < want) {
+			this->cancel_residency(tex, frame);
+		}
+		if (tex.resident < want && tex.resident < tex.header->mip_count) {
+			this->begin_residency(tex, want, cmd);
+			this->finish_residency(tex, cmd, frame);
+		}
+	}
+
+	// images started in earlier frames already hold their memory, so they go first
+	for (auto& tex : this->textures) {
+		if (tex.next == nullptr || staging_full) continue;
+		staging_full = !this->upload_pending(tex, cmd, staging, staging_ofs);
+		if (tex.pending_levels == 0u) {
+			this->finish_residency(tex, cmd, frame);
+		}
+	}
+
+	// mip tails of new textures ignore the budget, they are tiny
+	for (auto& tex : this->textures) {
+		if (staging_full) break;
+		if (tex.resident < tex.header->mip_count || tex.next != nullptr) continue;
+		this->begin_residency(tex, tex.tail, cmd);
+		staging_full = !this->upload_pending(tex, cmd, staging, staging_ofs);
+		if (tex.pending_levels == 0u) {
+			this->finish_residency(tex, cmd, frame);
+		}
+	}
+
+	// grow one level at a time, most recently used and furthest from what they want first
+	auto& growing = this->growing;
+	growing.clear();
+	for (auto& tex : this->textures) {
+		if (tex.next == nullptr && tex.resident < tex.header->mip_count && tex.resident > desired(tex)) {
+			growing.push_back(&tex);
+		}
+	}
+	std::sort(growing.begin(), growing.end(), [&](const Texture* a, const Texture* b) {
+		if (a->last_used != b->last_used) return a->last_used > b->last_used;
+		return a->resident - desired(*a) > b->resident - desired(*b);
+	});
+
+	for (auto tex : growing) {
+		if (staging_full) break;
+		auto target = tex->resident - 1u;
+		auto growth = this->bytes_from(*tex, target) - this->bytes_from(*tex, tex->resident);
+
+		while (this->resident_total + growth > this->budget) {
+			// evict the least recently used texture that holds more than its tail
+			Texture* victim = nullptr;
+			for (auto& other : this->textures) {
+				if (&other == tex || other.resident >= other.tail || other.last_used >= tex->last_used) continue;
+				if (victim == nullptr || other.last_used < victim->last_used) {
+					victim = &other;
+				}
+			}
+			if (victim == nullptr) break;
+			if (victim->next != nullptr) {
+				this->cancel_residency(*victim, frame);
+			}
+			this->begin_residency(*victim, victim->tail, cmd);
+			this->finish_residency(*victim, cmd, frame);
+		}
+		if (this->resident_total + growth > this->budget) continue;
+
+		this->begin_residency(*tex, target, cmd);
+		staging_full = !this->upload_pending(*tex, cmd, staging, staging_ofs);
+		if (tex->pending_levels == 0u) {
+			this->finish_residency(*tex, cmd, frame);
+		}
+	}
+
+	if (staging_ofs > 0u) {
+		this->alloc->flush(staging, 0u, staging_ofs);
+	}
+}
+
+auto TextureStreamer::view(TextureHandle tex) const -> vk::ImageView {
+	return this->textures.at(tex).view.get();
+}
+
+auto TextureStreamer::resident_mip(TextureHandle handle) const -> std::optional<u32> {
+	auto& tex = this->textures.at(handle);
+	if (tex.resident == tex.header->mip_count) return {};
+	return tex.resident;
+}
+
+auto TextureStreamer::resident_bytes() const -> u64 {
+	return this->resident_total;
+}
+
+void TextureStreamer::set_budget(u64 bytes) {
+	this->budget = bytes;
+}
+
+auto TextureStreamer::level(const Texture& tex, u32 lvl) const -> const TexMip& {
+	return tex.mips[tex.header->mip_count - 1u - lvl];
+}
+
+auto TextureStreamer::bytes_from(const Texture& tex, u32 lvl) const -> u64 {
+	auto sum = u64{0u};
+	for (auto l = lvl; l < tex.header->mip_count; l++) {
+		sum += this->level(tex, l).size;
+	}
+	return sum;
+}
+
+// level data is uploaded in rows of blocks, so a level larger than a frame's
+// staging buffer is spread over several frames
+auto TextureStreamer::block_rows(const Texture& tex, u32 lvl) const -> u32 {
+	auto block_h = u32{vk::blockExtent(static_cast<vk::Format>(tex.header->format))[1]};
+	return (this->level(tex, lvl).height + block_h - 1u) / block_h;
+}
+
+// Creates the image for levels lvl and coarser and copies the levels the current
+// image already holds into it. The levels it lacks are left to upload_pending,
+// the current image stays in use until finish_residency.
+void TextureStreamer::begin_residency(Texture& tex, u32 lvl, vk::CommandBuffer cmd) {
+	auto mip_count = tex.header->mip_count;
+	auto fmt = static_cast<vk::Format>(tex.header->format);
+	auto& top = this->level(tex, lvl);
+	auto img = this->alloc->create_image(PoolKind::Texture, vk::ImageCreateInfo{}
+		.setImageType(vk::ImageType::e2D)
+		.setFormat(fmt)
+		.setExtent({top.width, top.height, 1u})
+		.setMipLevels(mip_count - lvl)
+		.setArrayLayers(1u)
+		.setSamples(vk::SampleCountFlagBits::e1)
+		.setTiling(vk::ImageTiling::eOptimal)
+		// the next residency change copies out of it
+		.setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst)
+	);
+
+	auto to_dst = vk::ImageMemoryBarrier2{}
+		.setImage(img->img)
+		.setSubresourceRange(vk::ImageSubresourceRange{}
+			.setAspectMask(vk::ImageAspectFlagBits::eColor)
+			.setLevelCount(mip_count - lvl)
+			.setLayerCount(1u))
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eNone)
+		.setSrcAccessMask(vk::AccessFlagBits2::eNone)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eCopy)
+		.setDstAccessMask(vk::AccessFlagBits2::eTransferWrite)
+		.setOldLayout(vk::ImageLayout::eUndefined)
+		.setNewLayout(vk::ImageLayout::eTransferDstOptimal);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(to_dst));
+
+	if (tex.img != nullptr) {
+		auto first = std::max(lvl, tex.resident);
+		auto& copies = this->copy_regions;
+		copies.clear();
+		for (auto l = first; l < mip_count; l++) {
+			auto& mip = this->level(tex, l);
+			copies.push_back(vk::ImageCopy{}
+				.setSrcSubresource({vk::ImageAspectFlagBits::eColor, l - tex.resident, 0u, 1u})
+				.setDstSubresource({vk::ImageAspectFlagBits::eColor, l - lvl, 0u, 1u})
+				.setExtent({mip.width, mip.height, 1u})
+			);
+		}
+
+		// earlier frames may still be sampling the current image, which only needs
+		// an execution dependency since both sides read
+		auto to_src = vk::ImageMemoryBarrier2{}
+			.setImage(tex.img->img)
+			.setSubresourceRange(vk::ImageSubresourceRange{}
+				.setAspectMask(vk::ImageAspectFlagBits::eColor)
+				.setBaseMipLevel(first - tex.resident)
+				.setLevelCount(mip_count - first)
+				.setLayerCount(1u))
+			.setSrcStageMask(SAMPLING_STAGES)
+			.setSrcAccessMask(vk::AccessFlagBits2::eNone)
+			.setDstStageMask(vk::PipelineStageFlagBits2::eCopy)
+			.setDstAccessMask(vk::AccessFlagBits2::eTransferRead)
+			.setOldLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+			.setNewLayout(vk::ImageLayout::eTransferSrcOptimal);
+		cmd.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(to_src));
+		cmd.copyImage(
+			tex.img->img, vk::ImageLayout::eTransferSrcOptimal,
+			img->img, vk::ImageLayout::eTransferDstOptimal,
+			copies
+		);
+		auto back = to_src
+			.setSrcStageMask(vk::PipelineStageFlagBits2::eCopy)
+			.setSrcAccessMask(vk::AccessFlagBits2::eNone)
+			.setDstStageMask(SAMPLING_STAGES)
+			.setDstAccessMask(vk::AccessFlagBits2::eShaderSampledRead)
+			.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+			.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+		cmd.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(back));
+	}
+
+	// counted from here so the budget covers images that are still being filled
+	this->resident_total = this->resident_total + this->bytes_from(tex, lvl) - this->bytes_from(tex, tex.resident);
+	tex.next = img;
+	tex.next_lvl = lvl;
+	// nothing is resident yet when resident is mip_count, so every level is uploaded
+	tex.pending_levels = tex.resident > lvl ? tex.resident - lvl : 0u;
+	tex.pending_rows = 0u;
+}
+
+// uploads the levels the next image lacks, coarsest first, until this frame's
+// staging buffer is full, returns false when it ran out of room
+auto TextureStreamer::upload_pending(
+	Texture& tex,
+	vk::CommandBuffer cmd,
+	GpuBuffer* staging,
+	u64& staging_ofs
+) -> bool {
+	auto file = tex.file.bytes();
+	auto block_h = u32{vk::blockExtent(static_cast<vk::Format>(tex.header->format))[1]};
+	auto& regions = this->upload_regions;
+	regions.clear();
+
+	auto room = true;
+	while (tex.pending_levels > 0u) {
+		auto l = tex.next_lvl + tex.pending_levels - 1u;
+		auto& mip = this->level(tex, l);
+		auto rows = this->block_rows(tex, l);
+		auto row_bytes = mip.size / rows;
+		auto count = std::min(u64{rows - tex.pending_rows}, (staging->size - staging_ofs) / row_bytes);
+		if (count == 0u) {
+			room = false;
+			break;
+		}
+
+		auto bytes = count * row_bytes;
+		std::memcpy(
+			static_cast<std::byte*>(staging->mapped) + staging_ofs,
+			file.data() + mip.offset + tex.pending_rows * row_bytes,
+			bytes
+		);
+		auto y = tex.pending_rows * block_h;
+		regions.push_back(vk::BufferImageCopy{}
+			.setBufferOffset(staging_ofs)
+			.setImageSubresource({vk::ImageAspectFlagBits::eColor, l - tex.next_lvl, 0u, 1u})
+			.setImageOffset({0, cast<i32>(y), 0})
+			// only the last band may end inside a block, at the edge of the level
+			.setImageExtent({mip.width, std::min(cast<u32>(count) * block_h, mip.height - y), 1u})
+		);
+		// offsets stay aligned to TEX_DATA_ALIGN, which satisfies every block size
+		staging_ofs = std::min(align_up(staging_ofs + bytes, TEX_DATA_ALIGN), staging->size);
+
+		tex.pending_rows += cast<u32>(count);
+		if (tex.pending_rows == rows) {
+			tex.pending_levels--;
+			tex.pending_rows = 0u;
+		}
+	}
+
+	if (!regions.empty()) {
+		cmd.copyBufferToImage(staging->buf, tex.next->img, vk::ImageLayout::eTransferDstOptimal, regions);
+	}
+	return room;
+}
+
+// swaps in the next image once all of its levels are there
+void TextureStreamer::finish_residency(Texture& tex, vk::CommandBuffer cmd, u64 frame) {
+	auto range = vk::ImageSubresourceRange{}
+		.setAspectMask(vk::ImageAspectFlagBits::eColor)
+		.setLevelCount(tex.header->mip_count - tex.next_lvl)
+		.setLayerCount(1u);
+	auto to_read = vk::ImageMemoryBarrier2{}
+		.setImage(tex.next->img)
+		.setSubresourceRange(range)
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eCopy)
+		.setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+		.setDstStageMask(SAMPLING_STAGES)
+		.setDstAccessMask(vk::AccessFlagBits2::eShaderSampledRead)
+		.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+		.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(to_read));
+
+	auto view = this->dev.createImageViewUnique(vk::ImageViewCreateInfo{}
+		.setImage(tex.next->img)
+		.setViewType(vk::ImageViewType::e2D)
+		.setFormat(static_cast<vk::Format>(tex.header->format))
+		.setSubresourceRange(range)
+	);
+
+	// frames already recorded may still sample the old image
+	if (tex.img != nullptr) {
+		this->retired.push_back(Retired{ .frame = frame, .img = tex.img, .view = std::move(tex.view) });
+	}
+	tex.img = std::exchange(tex.next, nullptr);
+	tex.view = std::move(view);
+	tex.resident = tex.next_lvl;
+}
+
+// drops a next image that is no longer wanted, earlier frames may have uploaded into it
+void TextureStreamer::cancel_residency(Texture& tex, u64 frame) {
+	this->retired.push_back(Retired{ .frame = frame, .img = std::exchange(tex.next, nullptr), .view = {} });
+	this->resident_total = this->resident_total + this->bytes_from(tex, tex.resident) - this->bytes_from(tex, tex.next_lvl);
+	tex.pending_levels = 0u;
+	tex.pending_rows = 0u;
+}
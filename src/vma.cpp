@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <cassert>
 #include <stdexcept>
+#include <utility>
 
 #define VMA_IMPLEMENTATION
 #include <vk_mem_alloc.h>
@@ -6,32 +9,540 @@
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vulkan_hpp_macros.hpp>
 
+#include "sugar.hpp"
 #include "vma.hpp"
 
+// spread defragmentation over frames so no single frame pays for a full compaction
+constexpr vk::DeviceSize DEFRAG_BYTES_PER_PASS = 8u * 1024u * 1024u;
+constexpr u32 DEFRAG_ALLOCS_PER_PASS = 64u;
+
+static void require_vk(VkResult res, const char* msg) {
+	if (res != VK_SUCCESS) {
+		throw std::runtime_error(msg);
+	}
+}
+
+static auto pool_name(PoolKind kind) -> const char* {
+	switch (kind) {
+		case PoolKind::Geometry: return "geometry";
+		case PoolKind::Staging: return "staging";
+		case PoolKind::Texture: return "texture";
+		case PoolKind::Dynamic: return "dynamic";
+	}
+	return "unknown";
+}
+
+static auto pool_alloc_flags(PoolKind kind, bool dynamic_direct) -> VmaAllocationCreateFlags {
+	constexpr VmaAllocationCreateFlags host_write = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT
+		| VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	switch (kind) {
+		case PoolKind::Staging: return host_write;
+		case PoolKind::Dynamic: return dynamic_direct ? host_write : 0u;
+		default: return 0u;
+	}
+}
+
 VulkanAllocator::VulkanAllocator() {}
 
 VulkanAllocator::VulkanAllocator(
 	vk::Instance const inst,
 	vk::PhysicalDevice const pdev,
-	vk::Device const dev
-) {
+	vk::Device const dev,
+	bool has_mem_budget
+) : dev{dev} {
 	auto dispatch = VULKAN_HPP_DEFAULT_DISPATCHER;
 	auto vma_vk_funcs = VmaVulkanFunctions{};
 	vma_vk_funcs.vkGetInstanceProcAddr = dispatch.vkGetInstanceProcAddr;
 	vma_vk_funcs.vkGetDeviceProcAddr = dispatch.vkGetDeviceProcAddr;
 
 	auto allocator_info = VmaAllocatorCreateInfo{};
-  allocator_info.physicalDevice = pdev;
-  allocator_info.device = dev;
-  allocator_info.pVulkanFunctions = &vma_vk_funcs;
-  allocator_info.instance = inst;
+	allocator_info.physicalDevice = pdev;
+	allocator_info.device = dev;
+	allocator_info.pVulkanFunctions = &vma_vk_funcs;
+	allocator_info.instance = inst;
+	allocator_info.vulkanApiVersion = VK_API_VERSION_1_3;
+	if (has_mem_budget) {
+		allocator_info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+	}
 
 	auto res = vmaCreateAllocator(&allocator_info, &this->inner);
 	if (res != VK_SUCCESS) {
 		throw std::runtime_error("failed to initialize VMA");
 	}
+
+	this->init_pools();
 }
 
 VulkanAllocator::~VulkanAllocator() {
+	this->destroy();
+}
+
+VulkanAllocator::VulkanAllocator(VulkanAllocator&& other) noexcept {
+	*this = std::move(other);
+}
+
+VulkanAllocator& VulkanAllocator::operator=(VulkanAllocator&& other) noexcept {
+	if (this != &other) {
+		this->destroy();
+		this->inner = std::exchange(other.inner, VK_NULL_HANDLE);
+		this->dev = std::exchange(other.dev, vk::Device{});
+		this->pools = std::exchange(other.pools, {});
+		this->pool_types = other.pool_types;
+		this->dynamic_direct = other.dynamic_direct;
+		this->bufs = std::move(other.bufs);
+		this->imgs = std::move(other.imgs);
+		this->defrag = std::exchange(other.defrag, {});
+	}
+	return *this;
+}
+
+void VulkanAllocator::init_pools() {
+	// representative create infos, used only to pick a memory type for each pool
+	auto geometry_info = vk::BufferCreateInfo{}
+		.setSize(0x10000u)
+		.setUsage(vk::BufferUsageFlagBits::eVertexBuffer
+			| vk::BufferUsageFlagBits::eIndexBuffer
+			| vk::BufferUsageFlagBits::eStorageBuffer
+			| vk::BufferUsageFlagBits::eTransferSrc
+			| vk::BufferUsageFlagBits::eTransferDst);
+	auto staging_info = vk::BufferCreateInfo{}
+		.setSize(0x10000u)
+		.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+	auto dynamic_info = vk::BufferCreateInfo{}
+		.setSize(0x10000u)
+		.setUsage(vk::BufferUsageFlagBits::eVertexBuffer
+			| vk::BufferUsageFlagBits::eIndexBuffer
+			| vk::BufferUsageFlagBits::eStorageBuffer
+			| vk::BufferUsageFlagBits::eUniformBuffer
+			| vk::BufferUsageFlagBits::eIndirectBuffer
+			| vk::BufferUsageFlagBits::eTransferSrc
+			| vk::BufferUsageFlagBits::eTransferDst);
+	auto texture_info = vk::ImageCreateInfo{}
+		.setImageType(vk::ImageType::e2D)
+		.setFormat(vk::Format::eR8G8B8A8Srgb)
+		.setExtent({256u, 256u, 1u})
+		.setMipLevels(1u)
+		.setArrayLayers(1u)
+		.setSamples(vk::SampleCountFlagBits::e1)
+		.setTiling(vk::ImageTiling::eOptimal)
+		.setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst);
+
+	for (usz i = 0u; i < POOL_KIND_COUNT; i++) {
+		auto kind = static_cast<PoolKind>(i);
+		auto alloc_info = VmaAllocationCreateInfo{};
+		alloc_info.usage = kind == PoolKind::Staging
+			? VMA_MEMORY_USAGE_AUTO
+			: VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+		alloc_info.flags = pool_alloc_flags(kind, false);
+
+		u32 mem_type = 0u;
+		auto res = VK_ERROR_UNKNOWN;
+		switch (kind) {
+			case PoolKind::Geometry:
+				res = vmaFindMemoryTypeIndexForBufferInfo(
+					this->inner, &static_cast<VkBufferCreateInfo const&>(geometry_info), &alloc_info, &mem_type
+				);
+				break;
+			case PoolKind::Staging:
+				res = vmaFindMemoryTypeIndexForBufferInfo(
+					this->inner, &static_cast<VkBufferCreateInfo const&>(staging_info), &alloc_info, &mem_type
+				);
+				break;
+			case PoolKind::Texture:
+				res = vmaFindMemoryTypeIndexForImageInfo(
+					this->inner, &static_cast<VkImageCreateInfo const&>(texture_info), &alloc_info, &mem_type
+				);
+				break;
+			case PoolKind::Dynamic:
+				// memory that is both is the whole VRAM with resizable BAR, a 256 MiB
+				// window without, and everything on UMA GPUs
+				alloc_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+				alloc_info.flags = pool_alloc_flags(kind, true);
+				res = vmaFindMemoryTypeIndexForBufferInfo(
+					this->inner, &static_cast<VkBufferCreateInfo const&>(dynamic_info), &alloc_info, &mem_type
+				);
+				this->dynamic_direct = res == VK_SUCCESS;
+				if (!this->dynamic_direct) {
+					alloc_info.requiredFlags = 0u;
+					alloc_info.flags = pool_alloc_flags(kind, false);
+					res = vmaFindMemoryTypeIndexForBufferInfo(
+						this->inner, &static_cast<VkBufferCreateInfo const&>(dynamic_info), &alloc_info, &mem_type
+					);
+				}
+				break;
+		}
+		require_vk(res, "failed to find memory type for VMA pool");
+
+		this->pool_types[i] = mem_type;
+		auto pool_info = VmaPoolCreateInfo{};
+		pool_info.memoryTypeIndex = mem_type;
+		require_vk(vmaCreatePool(this->inner, &pool_info, &this->pools[i]), "failed to create VMA pool");
+		vmaSetPoolName(this->inner, this->pools[i], pool_name(kind));
+	}
+}
+
+void VulkanAllocator::destroy() {
+	if (this->inner == VK_NULL_HANDLE) return;
+
+	if (this->defrag.ctx != VK_NULL_HANDLE) {
+		if (this->defrag.pass_open) {
+			// the caller has waited for the device, so the copies are done
+			this->finish_defrag_pass();
+		}
+		if (this->defrag.ctx != VK_NULL_HANDLE) {
+			vmaEndDefragmentation(this->inner, this->defrag.ctx, nullptr);
+		}
+	}
+	for (auto& buf : this->bufs) {
+		vmaDestroyBuffer(this->inner, buf->buf, buf->alloc);
+	}
+	this->bufs.clear();
+	for (auto& img : this->imgs) {
+		vmaDestroyImage(this->inner, img->img, img->alloc);
+	}
+	this->imgs.clear();
+	for (auto pool : this->pools) {
+		if (pool != VK_NULL_HANDLE) {
+			vmaDestroyPool(this->inner, pool);
+		}
+	}
+	this->pools = {};
+
 	vmaDestroyAllocator(this->inner);
+	this->inner = VK_NULL_HANDLE;
+}
+
+void VulkanAllocator::set_frame_idx(u32 frame_idx) {
+	vmaSetCurrentFrameIndex(this->inner, frame_idx);
+}
+
+auto VulkanAllocator::create_buffer(
+	PoolKind pool,
+	vk::DeviceSize size,
+	vk::BufferUsageFlags usage,
+	std::span<const u32> queue_families
+) -> GpuBuffer* {
+	auto buf = std::make_unique<GpuBuffer>();
+	buf->size = size;
+	// defragmentation moves buffers with a GPU copy
+	buf->usage = usage | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+	buf->pool = pool;
+	buf->shared = queue_families.size() > 1u;
+
+	auto buf_info = vk::BufferCreateInfo{}
+		.setSize(size)
+		.setUsage(buf->usage)
+		.setSharingMode(vk::SharingMode::eExclusive);
+	if (buf->shared) {
+		buf_info
+			.setSharingMode(vk::SharingMode::eConcurrent)
+			.setQueueFamilyIndices(queue_families);
+	}
+	auto alloc_info = VmaAllocationCreateInfo{};
+	alloc_info.flags = pool_alloc_flags(pool, this->dynamic_direct) | VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT;
+	alloc_info.pool = this->pools[static_cast<usz>(pool)];
+	alloc_info.pUserData = buf.get();
+
+	auto raw_buf = VkBuffer{};
+	auto info = VmaAllocationInfo{};
+	auto res = vmaCreateBuffer(
+		this->inner,
+		&static_cast<VkBufferCreateInfo const&>(buf_info),
+		&alloc_info,
+		&raw_buf,
+		&buf->alloc,
+		&info
+	);
+	require_vk(res, "failed to allocate buffer within memory budget");
+
+	buf->buf = raw_buf;
+	buf->mapped = info.pMappedData;
+	this->bufs.push_back(std::move(buf));
+	return this->bufs.back().get();
+}
+
+void VulkanAllocator::destroy_buffer(GpuBuffer* buf) {
+	auto it = std::find_if(this->bufs.begin(), this->bufs.end(),
+		[buf](const std::unique_ptr<GpuBuffer>& b) { return b.get() == buf; }
+	);
+	assert(it != this->bufs.end() && "destroying a buffer not owned by this allocator");
+	assert(
+		std::find(this->defrag.moved.begin(), this->defrag.moved.end(), buf) == this->defrag.moved.end()
+		&& "destroying a buffer that is being moved by defragmentation"
+	);
+
+	vmaDestroyBuffer(this->inner, buf->buf, buf->alloc);
+	std::swap(*it, this->bufs.back());
+	this->bufs.pop_back();
+}
+
+void VulkanAllocator::flush(GpuBuffer* buf, vk::DeviceSize ofs, vk::DeviceSize size) {
+	require_vk(vmaFlushAllocation(this->inner, buf->alloc, ofs, size), "failed to flush buffer");
+}
+
+auto VulkanAllocator::dynamic_writes_direct() const -> bool {
+	return this->dynamic_direct;
+}
+
+auto VulkanAllocator::create_dynamic_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage) -> DynamicBuffer {
+	auto buf = DynamicBuffer{};
+	buf.gpu = this->create_buffer(PoolKind::Dynamic, size, usage);
+	if (this->dynamic_direct) {
+		buf.mapped = buf.gpu->mapped;
+	} else {
+		buf.staging = this->create_buffer(PoolKind::Staging, size, vk::BufferUsageFlagBits::eTransferSrc);
+		buf.mapped = buf.staging->mapped;
+	}
+	return buf;
+}
+
+void VulkanAllocator::destroy_dynamic_buffer(DynamicBuffer& buf) {
+	if (buf.staging != nullptr) {
+		this->destroy_buffer(buf.staging);
+	}
+	if (buf.gpu != nullptr) {
+		this->destroy_buffer(buf.gpu);
+	}
+	buf = DynamicBuffer{};
+}
+
+void VulkanAllocator::upload_dynamic(
+	vk::CommandBuffer cmd,
+	const DynamicBuffer& buf,
+	vk::DeviceSize size,
+	vk::PipelineStageFlags2 dst_stages,
+	vk::AccessFlags2 dst_access
+) {
+	if (size == 0u) return;
+	// the submission makes flushed host writes visible, in place that is all it takes
+	if (buf.staging == nullptr) {
+		this->flush(buf.gpu, 0u, size);
+		return;
+	}
+
+	this->flush(buf.staging, 0u, size);
+	cmd.copyBuffer(buf.staging->buf, buf.gpu->buf, vk::BufferCopy{0u, 0u, size});
+	auto barrier = vk::BufferMemoryBarrier2{}
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eCopy)
+		.setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+		.setDstStageMask(dst_stages)
+		.setDstAccessMask(dst_access)
+		.setSrcQueueFamilyIndex(vk::QueueFamilyIgnored)
+		.setDstQueueFamilyIndex(vk::QueueFamilyIgnored)
+		.setBuffer(buf.gpu->buf)
+		.setOffset(0u)
+		.setSize(size);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setBufferMemoryBarriers(barrier));
+}
+
+auto VulkanAllocator::create_image(PoolKind pool, const vk::ImageCreateInfo& cinfo) -> GpuImage* {
+	auto alloc_info = VmaAllocationCreateInfo{};
+	alloc_info.flags = pool_alloc_flags(pool, this->dynamic_direct) | VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT;
+	alloc_info.pool = this->pools[static_cast<usz>(pool)];
+
+	// the pool's memory type was picked with a probe image, other formats (BCn in
+	// particular) or usages may not allow it, those get memory outside the pool
+	auto reqs = this->dev.getImageMemoryRequirements(vk::DeviceImageMemoryRequirements{}.setPCreateInfo(&cinfo));
+	if ((reqs.memoryRequirements.memoryTypeBits & (1u << this->pool_types[static_cast<usz>(pool)])) == 0u) {
+		alloc_info.pool = VK_NULL_HANDLE;
+		alloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+	}
+	return this->create_image(cinfo, alloc_info);
+}
+
+auto VulkanAllocator::create_render_target(const vk::ImageCreateInfo& cinfo) -> GpuImage* {
+	auto alloc_info = VmaAllocationCreateInfo{};
+	alloc_info.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+	alloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+	return this->create_image(cinfo, alloc_info);
+}
+
+auto VulkanAllocator::create_image(
+	const vk::ImageCreateInfo& cinfo,
+	const VmaAllocationCreateInfo& alloc_info
+) -> GpuImage* {
+	auto img = std::make_unique<GpuImage>();
+	img->extent = cinfo.extent;
+	img->fmt = cinfo.format;
+	img->mip_levels = cinfo.mipLevels;
+
+	auto raw_img = VkImage{};
+	auto res = vmaCreateImage(
+		this->inner,
+		&static_cast<VkImageCreateInfo const&>(cinfo),
+		&alloc_info,
+		&raw_img,
+		&img->alloc,
+		nullptr
+	);
+	require_vk(res, "failed to allocate image within memory budget");
+
+	img->img = raw_img;
+	this->imgs.push_back(std::move(img));
+	return this->imgs.back().get();
+}
+
+void VulkanAllocator::destroy_image(GpuImage* img) {
+	auto it = std::find_if(this->imgs.begin(), this->imgs.end(),
+		[img](const std::unique_ptr<GpuImage>& i) { return i.get() == img; }
+	);
+	assert(it != this->imgs.end() && "destroying an image not owned by this allocator");
+
+	vmaDestroyImage(this->inner, img->img, img->alloc);
+	std::swap(*it, this->imgs.back());
+	this->imgs.pop_back();
+}
+
+auto VulkanAllocator::heap_budgets() const -> std::vector<HeapBudget> {
+	const VkPhysicalDeviceMemoryProperties* mem_props = nullptr;
+	vmaGetMemoryProperties(this->inner, &mem_props);
+
+	auto budgets = std::array<VmaBudget, VK_MAX_MEMORY_HEAPS>{};
+	vmaGetHeapBudgets(this->inner, budgets.data());
+
+	auto ret = std::vector<HeapBudget>{};
+	ret.reserve(mem_props->memoryHeapCount);
+	for (u32 i = 0u; i < mem_props->memoryHeapCount; i++) {
+		auto& b = budgets[i];
+		ret.push_back(HeapBudget {
+			.heap_idx = i,
+			.flags = vk::MemoryHeapFlags(mem_props->memoryHeaps[i].flags),
+			.usage = b.usage,
+			.budget = b.budget,
+			.block_bytes = b.statistics.blockBytes,
+			.alloc_bytes = b.statistics.allocationBytes,
+			.blocks = b.statistics.blockCount,
+			.allocs = b.statistics.allocationCount,
+		});
+	}
+	return ret;
+}
+
+// checked from the frame loop, so unlike heap_budgets() this does not allocate
+auto VulkanAllocator::heap_pressure() const -> flt {
+	const VkPhysicalDeviceMemoryProperties* mem_props = nullptr;
+	vmaGetMemoryProperties(this->inner, &mem_props);
+
+	auto budgets = std::array<VmaBudget, VK_MAX_MEMORY_HEAPS>{};
+	vmaGetHeapBudgets(this->inner, budgets.data());
+
+	auto pressure = 0.0f;
+	for (u32 i = 0u; i < mem_props->memoryHeapCount; i++) {
+		if (budgets[i].budget == 0u) continue;
+		pressure = std::max(pressure, static_cast<flt>(budgets[i].usage) / static_cast<flt>(budgets[i].budget));
+	}
+	return pressure;
+}
+
+void VulkanAllocator::print_budgets(std::ostream& out) const {
+	constexpr auto MIB = 1024.0 * 1024.0;
+	for (auto& heap : this->heap_budgets()) {
+		out << "heap " << heap.heap_idx
+			<< ((heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) ? " (device)" : " (host)")
+			<< ": " << static_cast<dbl>(heap.usage) / MIB
+			<< " / " << static_cast<dbl>(heap.budget) / MIB << " MiB, "
+			<< heap.allocs << " allocs in " << heap.blocks << " blocks ("
+			<< static_cast<dbl>(heap.alloc_bytes) / MIB << " / "
+			<< static_cast<dbl>(heap.block_bytes) / MIB << " MiB used)"
+			<< std::endl;
+	}
+}
+
+auto VulkanAllocator::stats_json(bool detailed) const -> std::string {
+	char* raw = nullptr;
+	vmaBuildStatsString(this->inner, &raw, detailed ? VK_TRUE : VK_FALSE);
+	auto ret = std::string(raw);
+	vmaFreeStatsString(this->inner, raw);
+	return ret;
+}
+
+void VulkanAllocator::begin_defrag(PoolKind pool) {
+	if (this->defrag.ctx != VK_NULL_HANDLE) return;
+
+	auto info = VmaDefragmentationInfo{};
+	info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+	info.pool = this->pools[static_cast<usz>(pool)];
+	info.maxBytesPerPass = DEFRAG_BYTES_PER_PASS;
+	info.maxAllocationsPerPass = DEFRAG_ALLOCS_PER_PASS;
+	require_vk(vmaBeginDefragmentation(this->inner, &info, &this->defrag.ctx), "failed to begin defragmentation");
+}
+
+auto VulkanAllocator::defrag_active() const -> bool {
+	return this->defrag.ctx != VK_NULL_HANDLE;
+}
+
+void VulkanAllocator::record_defrag_pass(vk::CommandBuffer cmd) {
+	if (this->defrag.ctx == VK_NULL_HANDLE || this->defrag.pass_open) return;
+
+	auto res = vmaBeginDefragmentationPass(this->inner, this->defrag.ctx, &this->defrag.pass);
+	if (res == VK_SUCCESS) {
+		// nothing left to move
+		vmaEndDefragmentation(this->inner, this->defrag.ctx, nullptr);
+		this->defrag.ctx = VK_NULL_HANDLE;
+		return;
+	}
+	if (res != VK_INCOMPLETE) {
+		throw std::runtime_error("failed to begin defragmentation pass");
+	}
+
+	for (u32 i = 0u; i < this->defrag.pass.moveCount; i++) {
+		auto& move = this->defrag.pass.pMoves[i];
+		auto info = VmaAllocationInfo{};
+		vmaGetAllocationInfo(this->inner, move.srcAllocation, &info);
+		auto buf = static_cast<GpuBuffer*>(info.pUserData);
+		if (buf == nullptr || buf->shared) {
+			move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+			continue;
+		}
+
+		auto new_buf = this->dev.createBuffer(vk::BufferCreateInfo{}
+			.setSize(buf->size)
+			.setUsage(buf->usage)
+			.setSharingMode(vk::SharingMode::eExclusive)
+		);
+		require_vk(vmaBindBufferMemory(this->inner, move.dstTmpAllocation, new_buf), "failed to bind moved buffer");
+
+		cmd.copyBuffer(buf->buf, new_buf, vk::BufferCopy{0u, 0u, buf->size});
+
+		// later frames pick up the new handle, the old one lives until the copy has executed
+		this->defrag.retired.push_back(buf->buf);
+		this->defrag.moved.push_back(buf);
+		buf->buf = new_buf;
+	}
+
+	auto barrier = vk::MemoryBarrier2{}
+		.setSrcStageMask(vk::PipelineStageFlagBits2::eCopy)
+		.setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+		.setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands)
+		.setDstAccessMask(vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite);
+	cmd.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(barrier));
+
+	this->defrag.pass_open = true;
+}
+
+void VulkanAllocator::finish_defrag_pass() {
+	if (!this->defrag.pass_open) return;
+
+	for (auto buf : this->defrag.retired) {
+		this->dev.destroyBuffer(buf);
+	}
+	this->defrag.retired.clear();
+
+	auto res = vmaEndDefragmentationPass(this->inner, this->defrag.ctx, &this->defrag.pass);
+
+	// srcAllocation now points at the new memory, so refresh persistent mappings
+	for (auto buf : this->defrag.moved) {
+		auto info = VmaAllocationInfo{};
+		vmaGetAllocationInfo(this->inner, buf->alloc, &info);
+		buf->mapped = info.pMappedData;
+	}
+	this->defrag.moved.clear();
+	this->defrag.pass_open = false;
+
+	if (res == VK_SUCCESS) {
+		vmaEndDefragmentation(this->inner, this->defrag.ctx, nullptr);
+		this->defrag.ctx = VK_NULL_HANDLE;
+	} else if (res != VK_INCOMPLETE) {
+		throw std::runtime_error("failed to end defragmentation pass");
+	}
 }